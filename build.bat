@@ -20,7 +20,7 @@ REM cl %CommonCompilerFlags% ..\loderunner\src\win32_loderunner.cpp /link -subsy
 
 REM 64-bit build
 
-cl %CommonCompilerFlags% ..\loderunner\src\loderunner.cpp -LD /link -incremental:no -PDB:loderunner_%random%.pdb /EXPORT:GameUpdateAndRender -OUT:gamelib.dll
+cl %CommonCompilerFlags% ..\loderunner\src\loderunner.cpp -LD /link -incremental:no -PDB:loderunner_%random%.pdb /EXPORT:GameUpdateAndRender /EXPORT:GameSaveState /EXPORT:GameLoadState -OUT:gamelib.dll
 cl %CommonCompilerFlags% ..\loderunner\src\win32_loderunner.cpp /link %CommonLinkerFlags%
 
 popd
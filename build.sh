@@ -3,7 +3,8 @@
 echo "Starting build"
 
 CFLAGS="-g -std=c++11 -DBUILD_INTERNAL=1 -DBUILD_SLOW=1"
-LFLAGS="$(pkg-config --cflags --libs x11) -ldl"
+LFLAGS="$(pkg-config --cflags --libs x11 xext) -ldl -lpthread"
 
 gcc $CFLAGS -shared -o loderunner.so -fPIC ../src/loderunner.cpp
 gcc $CFLAGS ../src/linux_loderunner.cpp $LFLAGS -o loderunner
+gcc $CFLAGS ../src/headless_loderunner.cpp -ldl -lpthread -o loderunner_headless
@@ -0,0 +1,960 @@
+// Runs the game without a display: input comes from a script, frames
+// are rendered into memory and can be dumped as PPM files.
+//
+// Usage: loderunner_headless [options]
+//   --game PATH      game library (loderunner.so next to the executable)
+//   --data DIR       where the assets are (data/ next to the executable)
+//   --script FILE    input script, see below. No input if omitted.
+//   --frames N       how many frames to run (600)
+//   --ticks N        game ticks per frame (1), more to fast-forward
+//   --render-every N only render every Nth frame (1), 0 to only render
+//                    the last one and the dumps
+//   --width W        backbuffer size (1500x1000)
+//   --height H
+//   --scale N        game pixel size, see game_memory::RenderScale
+//   --huge-pages 1   back the hot parts of the game memory with
+//                    transparent huge pages
+//   --threads N      worker threads (cores - 1), 0 does all the work
+//                    on the main thread
+//   --dump N         write frame N to frame_N.ppm, can be repeated
+//   --dump-dir DIR   where to write the dumps (current directory)
+//   --level N        the level to start on, 1 to 13 (1)
+//   --level-file FILE  play the level in FILE instead of the built-in
+//                    ones, written like those in loderunner_levels.cpp
+//                    without the quotes. A replay recorded with it
+//                    needs the same file to play back.
+//   --batch N        simulate N games without rendering and report
+//                    how they went, see below
+//   --seed N         random seed (1), batch game i gets N + i
+//   --record FILE    save the input as a replay
+//   --hash-every N   store the game's state hash in the replay every N
+//                    ticks (60), 1 to find the exact tick a replay
+//                    stops playing out the same way
+//   --replay FILE    play a replay instead of the script, with its own
+//                    level and seed. --frames defaults to all of it.
+//                    Exits with 2 if it plays out differently.
+//   --seek T         start the replay from tick T, using its keyframes
+//   --rewind N       keep the last N frames while playing, then go back
+//                    through all of them and show where that ends up
+//   --rewind-memory M  keep at most M megabytes of them (64)
+//
+// The script has one event per line: a frame number, then + or - and
+// a button name (up, down, left, right, fire, turbo, debug, menu),
+// optionally followed by the player number. Events take effect from
+// the frame they name. Lines starting with # are ignored:
+//
+//   # walk right for a second, then dig
+//   60 +right
+//   120 -right
+//   120 +fire
+//   125 -fire
+//
+// In batch mode game i starts on level N + i, going back to level 1
+// after the last one, and runs until the player dies, completes the
+// level or --frames frames pass. The games are split between the worker
+// threads and the main thread. Every game follows the script if there
+// is one, otherwise a bot mashes random buttons.
+
+#include "loderunner_platform.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "loderunner.h"
+#include "linux_work_queue.cpp"
+#include "linux_memory.cpp"
+#include "loderunner_replay.cpp"
+#include "loderunner_rewind.cpp"
+
+struct script_event {
+  int Frame;
+  int Player;
+  int Button;
+  bool32 IsDown;
+};
+
+struct input_script {
+  int EventCount;
+  int MaxEventCount;
+  script_event *Events;
+  int NextEvent;
+};
+
+struct headless_bot {
+  random_series Random;
+  int FramesLeft;  // until it presses something else
+};
+
+// Far from the streams the game uses for its levels
+const u64 kBotRandomStream = 1ull << 32;
+
+struct batch_game {
+  int StartLevel;
+  game_stats Stats;
+};
+
+// Shared by all the workers, the games are handed out one at a time
+struct batch_work {
+  game_update_and_render *UpdateAndRender;
+  input_script *Script;  // NULL to let the bot play
+  char const *LevelText;
+  int MemorySize;  // of each worker's game memory
+  u64 Seed;
+  int FrameCount;
+  r32 SecondsPerFrame;
+
+  int GameCount;
+  batch_game *Games;
+  u32 volatile NextGame;
+};
+
+struct batch_worker {
+  batch_work *Work;
+  int GamesPlayed;
+  u64 Ticks;
+  u64 CPUTime;  // nanoseconds the worker's thread spent playing
+};
+
+struct headless_file {
+  char Name[64];
+  file_read_result Contents;
+};
+
+global char gDataDir[PATH_MAX];
+
+// The game never writes into what it reads,
+// so all batch games share one copy of each file
+global headless_file gFiles[16];
+global int gFileCount;
+global pthread_mutex_t gFileMutex = PTHREAD_MUTEX_INITIALIZER;
+
+global const char *kButtonNames[INPUT_BUTTON_COUNT] = {
+    "up", "down", "left", "right", "fire", "turbo", "debug", "menu",
+};
+
+internal void HeadlessGetExeDir(char *PathToExe) {
+  ssize_t Length = readlink("/proc/self/exe", PathToExe, PATH_MAX - 1);
+  PathToExe[Length > 0 ? Length : 0] = 0;
+
+  // Cut the file name
+  char *OnePastLastSlash = PathToExe;
+  for (char *Scan = PathToExe; *Scan; Scan++) {
+    if (*Scan == '/') {
+      OnePastLastSlash = Scan + 1;
+    }
+  }
+  *OnePastLastSlash = 0;
+}
+
+DEBUG_PLATFORM_READ_ENTIRE_FILE(HeadlessReadEntireFile) {
+  file_read_result Result = {};
+
+  pthread_mutex_lock(&gFileMutex);
+  for (int i = 0; i < gFileCount; i++) {
+    if (strcmp(gFiles[i].Name, Filename) == 0) {
+      Result = gFiles[i].Contents;
+      pthread_mutex_unlock(&gFileMutex);
+      return Result;
+    }
+  }
+
+  char FilePath[PATH_MAX];
+  snprintf(FilePath, PATH_MAX, "%s/%s", gDataDir, Filename);
+
+  FILE *f = fopen(FilePath, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot open file: %s\n", FilePath);
+    exit(1);
+  }
+
+  fseek(f, 0, SEEK_END);
+  long fsize = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  Result.MemorySize = fsize;
+  Result.Memory = malloc(fsize);
+  fread(Result.Memory, fsize, 1, f);
+  fclose(f);
+
+  if (gFileCount < (int)COUNT_OF(gFiles) &&
+      strlen(Filename) < sizeof(gFiles[0].Name)) {
+    headless_file *File = &gFiles[gFileCount++];
+    strcpy(File->Name, Filename);
+    File->Contents = Result;
+  }
+  pthread_mutex_unlock(&gFileMutex);
+
+  return Result;
+}
+
+inline u64 HeadlessGetWallClock() {
+  struct timespec spec;
+  clock_gettime(CLOCK_MONOTONIC, &spec);
+
+  u64 Result = (u64)spec.tv_sec * 1000000000ull + (u64)spec.tv_nsec;
+  return Result;
+}
+
+// Only counts the time the calling thread was actually running
+inline u64 HeadlessGetThreadCPUTime() {
+  struct timespec spec;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &spec);
+
+  u64 Result = (u64)spec.tv_sec * 1000000000ull + (u64)spec.tv_nsec;
+  return Result;
+}
+
+// Returns the level as a string, or NULL if it can't be played.
+// ArenaSize is how much of the level arena it takes.
+internal char *HeadlessLoadLevelFile(char const *Path, i64 *ArenaSize) {
+  FILE *f = fopen(Path, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot open level: %s\n", Path);
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  long Size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *Text = (char *)calloc(1, Size + 1);
+  fread(Text, Size, 1, f);
+  fclose(f);
+
+  // Measured the way LoadLevel does it
+  int Width = 0;
+  int MaxWidth = 0;
+  int Height = 1;
+  for (char *At = Text; *At; At++) {
+    if (*At == '\n') {
+      Width = 0;
+      Height++;
+    } else if (*At != '\r') {
+      Width++;
+    }
+    if (MaxWidth < Width) {
+      MaxWidth = Width;
+    }
+  }
+  if (MaxWidth == 0 || (i64)MaxWidth * Height > kMaxLevelTileCount) {
+    fprintf(stderr, "%s: the level is %dx%d, it can have 1 to %d tiles\n",
+            Path, MaxWidth, Height, kMaxLevelTileCount);
+    free(Text);
+    return NULL;
+  }
+
+  *ArenaSize = GetLevelArenaSize(MaxWidth, Height);
+  return Text;
+}
+
+internal bool32 HeadlessLoadScript(input_script *Script, char const *Path) {
+  FILE *f = fopen(Path, "r");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot open script: %s\n", Path);
+    return false;
+  }
+
+  char Line[256];
+  int LineNumber = 0;
+  while (fgets(Line, sizeof(Line), f)) {
+    LineNumber++;
+
+    char *Scan = Line;
+    while (*Scan == ' ' || *Scan == '\t') Scan++;
+    if (*Scan == '#' || *Scan == '\n' || *Scan == '\r' || *Scan == 0) {
+      continue;
+    }
+
+    script_event Event = {};
+    char Button[32];
+    int Player = 1;
+    int Matched = sscanf(Scan, "%d %31s %d", &Event.Frame, Button, &Player);
+    if (Matched < 2 || (Button[0] != '+' && Button[0] != '-') ||
+        Player < 1 || Player > 2) {
+      fprintf(stderr, "%s:%d: expected \"<frame> +|-<button> [player]\"\n",
+              Path, LineNumber);
+      fclose(f);
+      return false;
+    }
+    Event.IsDown = (Button[0] == '+');
+    Event.Player = Player - 1;
+    Event.Button = -1;
+    for (int i = 0; i < INPUT_BUTTON_COUNT; i++) {
+      if (strcmp(Button + 1, kButtonNames[i]) == 0) {
+        Event.Button = i;
+      }
+    }
+    if (Event.Button < 0) {
+      fprintf(stderr, "%s:%d: unknown button %s\n", Path, LineNumber,
+              Button + 1);
+      fclose(f);
+      return false;
+    }
+
+    if (Script->EventCount == Script->MaxEventCount) {
+      Script->MaxEventCount = Script->MaxEventCount ? Script->MaxEventCount * 2 : 64;
+      Script->Events = (script_event *)realloc(
+          Script->Events, Script->MaxEventCount * sizeof(script_event));
+    }
+
+    // Keep the events sorted by frame, stable for the same frame
+    int Index = Script->EventCount++;
+    while (Index > 0 && Script->Events[Index - 1].Frame > Event.Frame) {
+      Script->Events[Index] = Script->Events[Index - 1];
+      Index--;
+    }
+    Script->Events[Index] = Event;
+  }
+
+  fclose(f);
+  return true;
+}
+
+inline void HeadlessSetButton(game_button_state *Button, bool32 IsDown) {
+  if (Button->EndedDown != IsDown) {
+    Button->EndedDown = IsDown;
+    Button->HalfTransitionCount++;
+  }
+}
+
+internal void HeadlessApplyScript(input_script *Script, int Frame,
+                                  game_input *Input) {
+  while (Script->NextEvent < Script->EventCount &&
+         Script->Events[Script->NextEvent].Frame <= Frame) {
+    script_event *Event = &Script->Events[Script->NextEvent++];
+    HeadlessSetButton(&Input->Players[Event->Player].Buttons[Event->Button],
+                      Event->IsDown);
+  }
+}
+
+// Holds one direction for a random while, digging every now and then
+internal void HeadlessApplyBot(headless_bot *Bot, game_input *Input) {
+  if (Bot->FramesLeft-- > 0) {
+    return;
+  }
+  Bot->FramesLeft = 10 + RandomChoice(&Bot->Random, 50);
+
+  player_input *Player = &Input->Player1;
+  int Direction = RandomChoice(&Bot->Random, 4);
+  HeadlessSetButton(&Player->Up, Direction == 0);
+  HeadlessSetButton(&Player->Down, Direction == 1);
+  HeadlessSetButton(&Player->Left, Direction == 2);
+  HeadlessSetButton(&Player->Right, Direction == 3);
+  HeadlessSetButton(&Player->Fire, RandomChoice(&Bot->Random, 4) == 0);
+}
+
+// Starts a new frame of input, the buttons stay down until released
+internal void HeadlessSwapInputs(game_input **OldInput,
+                                 game_input **NewInput) {
+  game_input *TmpInput = *OldInput;
+  *OldInput = *NewInput;
+  *NewInput = TmpInput;
+  **NewInput = {};
+  for (int p = 0; p < (int)COUNT_OF((*NewInput)->Players); p++) {
+    player_input *OldPlayerInput = &(*OldInput)->Players[p];
+    player_input *NewPlayerInput = &(*NewInput)->Players[p];
+    for (int b = 0; b < (int)COUNT_OF(OldPlayerInput->Buttons); b++) {
+      NewPlayerInput->Buttons[b].EndedDown =
+          OldPlayerInput->Buttons[b].EndedDown;
+    }
+  }
+}
+
+internal bool32 HeadlessWritePPM(char const *Path,
+                                 game_offscreen_buffer *Buffer) {
+  FILE *f = fopen(Path, "wb");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot write %s\n", Path);
+    return false;
+  }
+
+  fprintf(f, "P6\n%d %d\n255\n", Buffer->Width, Buffer->Height);
+
+  u8 *Row = (u8 *)malloc(Buffer->Width * 3);
+  for (int Y = 0; Y < Buffer->Height; Y++) {
+    u32 *Pixel = (u32 *)Buffer->Memory + Buffer->Width * Y;
+    for (int X = 0; X < Buffer->Width; X++) {
+      Row[X * 3 + 0] = (u8)(Pixel[X] >> 16);
+      Row[X * 3 + 1] = (u8)(Pixel[X] >> 8);
+      Row[X * 3 + 2] = (u8)(Pixel[X] >> 0);
+    }
+    fwrite(Row, Buffer->Width * 3, 1, f);
+  }
+  free(Row);
+
+  fclose(f);
+  return true;
+}
+
+internal bool32 HeadlessLoadReplay(replay_playback *Playback,
+                                   char const *Path) {
+  FILE *f = fopen(Path, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot open replay %s\n", Path);
+    return false;
+  }
+  fseek(f, 0, SEEK_END);
+  long FileSize = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  // Stays around for as long as the replay plays
+  void *File = malloc(FileSize > 0 ? FileSize : 1);
+  bool32 Result = fread(File, 1, FileSize, f) == (size_t)FileSize &&
+                  ReplayBeginPlayback(Playback, File, (int)FileSize);
+  fclose(f);
+
+  if (!Result) {
+    fprintf(stderr, "%s is not a replay this version can play\n", Path);
+  }
+  return Result;
+}
+
+internal bool32 HeadlessSaveReplay(replay_recording *Recording,
+                                   char const *Path) {
+  ReplayEndRecording(Recording);
+
+  FILE *f = fopen(Path, "wb");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot write replay %s\n", Path);
+    return false;
+  }
+  fwrite(&Recording->Header, sizeof(Recording->Header), 1, f);
+  fwrite(Recording->Data, Recording->Size, 1, f);
+  fclose(f);
+
+  return true;
+}
+
+// FNV-1a, to compare runs without dumping images
+internal u64 HeadlessHashBuffer(game_offscreen_buffer *Buffer) {
+  u64 Hash = 14695981039346656037ull;
+  u8 *Byte = (u8 *)Buffer->Memory;
+  int Size = Buffer->Width * Buffer->Height * Buffer->BytesPerPixel;
+  for (int i = 0; i < Size; i++) {
+    Hash ^= Byte[i];
+    Hash *= 1099511628211ull;
+  }
+  return Hash;
+}
+
+// Until the player dies or completes the level, or the frames run out
+internal void HeadlessPlayBatchGame(batch_work *Work, game_memory *Memory,
+                                   int GameIndex) {
+  batch_game *Game = &Work->Games[GameIndex];
+
+  // Start over with whatever the previous game used
+  memset(Memory->Start, 0, (u8 *)Memory->Free - (u8 *)Memory->Start);
+  Memory->Free = Memory->Start;
+  Memory->StartLevel = Game->StartLevel;
+  Memory->LevelText = Work->LevelText;
+  Memory->RandomSeed = Work->Seed + (u64)GameIndex;
+  Memory->Stats = {};
+
+  input_script Script = {};
+  if (Work->Script) {
+    Script = *Work->Script;
+    Script.NextEvent = 0;
+  }
+  headless_bot Bot = {};
+  Bot.Random = RandomSeed(Memory->RandomSeed, kBotRandomStream);
+
+  platform_sound_output SoundOutput = {};
+  game_input Input[2] = {};
+  game_input *OldInput = &Input[0];
+  game_input *NewInput = &Input[1];
+
+  for (int Frame = 0; Frame < Work->FrameCount; Frame++) {
+    if (Work->Script) {
+      HeadlessApplyScript(&Script, Frame, NewInput);
+    } else {
+      HeadlessApplyBot(&Bot, NewInput);
+    }
+    NewInput->dtForFrame = Work->SecondsPerFrame;
+
+    bool32 RedrawLevel = false;
+    int Quit = Work->UpdateAndRender(NewInput, NULL, Memory, &SoundOutput,
+                                     RedrawLevel);
+    HeadlessSwapInputs(&OldInput, &NewInput);
+
+    if (Quit || Memory->Stats.Deaths > 0 ||
+        Memory->Stats.LevelsCompleted > 0) {
+      break;
+    }
+  }
+
+  Game->Stats = Memory->Stats;
+}
+
+internal PLATFORM_WORK_QUEUE_CALLBACK(HeadlessDoBatchWork) {
+  batch_worker *Worker = (batch_worker *)Data;
+  batch_work *Work = Worker->Work;
+  u64 StartTime = HeadlessGetThreadCPUTime();
+
+  // One game memory per worker, reused by all of its games
+  game_memory Memory = {};
+  Memory.MemorySize = Work->MemorySize;
+  Memory.Start = calloc(1, Memory.MemorySize);
+  Memory.Free = Memory.Start;
+  Memory.IsInitialized = true;
+  Memory.DEBUGPlatformReadEntireFile = HeadlessReadEntireFile;
+
+  for (;;) {
+    u32 GameIndex = __sync_fetch_and_add(&Work->NextGame, 1);
+    if (GameIndex >= (u32)Work->GameCount) {
+      break;
+    }
+    HeadlessPlayBatchGame(Work, &Memory, (int)GameIndex);
+    Worker->GamesPlayed++;
+    Worker->Ticks += Work->Games[GameIndex].Stats.Ticks;
+  }
+
+  free(Memory.Start);
+  Worker->CPUTime = HeadlessGetThreadCPUTime() - StartTime;
+}
+
+internal void HeadlessRunBatch(batch_work *Work, int ThreadCount) {
+  // The main thread works too while waiting for the others
+  platform_work_queue Queue = {};
+  LinuxMakeQueue(&Queue, ThreadCount);
+  int WorkerCount = ThreadCount + 1;
+  batch_worker *Workers =
+      (batch_worker *)calloc(WorkerCount, sizeof(batch_worker));
+
+  u64 StartTime = HeadlessGetWallClock();
+  for (int i = 0; i < WorkerCount; i++) {
+    Workers[i].Work = Work;
+    LinuxAddEntry(&Queue, HeadlessDoBatchWork, &Workers[i]);
+  }
+  LinuxCompleteAllWork(&Queue);
+  r64 Seconds = (r64)(HeadlessGetWallClock() - StartTime) / 1.0e9;
+
+  u64 Ticks = 0;
+  u64 CPUTime = 0;
+  for (int i = 0; i < WorkerCount; i++) {
+    Ticks += Workers[i].Ticks;
+    CPUTime += Workers[i].CPUTime;
+  }
+  r64 CPUSeconds = (r64)CPUTime / 1.0e9;
+
+  int Wins = 0;
+  int Deaths = 0;
+  u64 TicksToDeath = 0;
+  int Treasures = 0;
+  for (int i = 0; i < Work->GameCount; i++) {
+    game_stats *Stats = &Work->Games[i].Stats;
+    if (Stats->LevelsCompleted > 0) {
+      Wins++;
+    }
+    if (Stats->Deaths > 0) {
+      Deaths++;
+      TicksToDeath += Stats->FirstDeathTick;
+    }
+    Treasures += Stats->TreasuresCollected;
+  }
+
+  int GameCount = Work->GameCount;
+  printf("games: %d on %d threads\n", GameCount, WorkerCount);
+  printf("time: %.3fs, %.3fs of cpu\n", Seconds, CPUSeconds);
+  printf("ticks: %llu, %.0f per second, %.0f per second per core\n",
+         (unsigned long long)Ticks, Seconds > 0 ? (r64)Ticks / Seconds : 0.0,
+         CPUSeconds > 0 ? (r64)Ticks / CPUSeconds : 0.0);
+  printf("won: %d (%.1f%%)\n", Wins, 100.0 * Wins / GameCount);
+  printf("died: %d (%.1f%%), after %.2fs on average\n", Deaths,
+         100.0 * Deaths / GameCount,
+         Deaths ? (r64)TicksToDeath / Deaths / kTicksPerSecond : 0.0);
+  printf("treasures collected: %.2f per game\n",
+         (r64)Treasures / GameCount);
+
+  free(Workers);
+}
+
+int main(int argc, char const *argv[]) {
+  char ExeDir[PATH_MAX];
+  HeadlessGetExeDir(ExeDir);
+
+  char GamePath[PATH_MAX];
+  snprintf(GamePath, PATH_MAX, "%sloderunner.so", ExeDir);
+  snprintf(gDataDir, PATH_MAX, "%sdata", ExeDir);
+
+  char const *ScriptPath = NULL;
+  char const *DumpDir = ".";
+  int FrameCount = 600;
+  bool32 FrameCountGiven = false;
+  int TicksPerFrame = 1;
+  int RenderEvery = 1;
+  int Width = 1500;
+  int Height = 1000;
+  int RenderScale = 0;
+  int ThreadCount = (int)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  int StartLevel = 1;
+  int BatchSize = 0;
+  u64 Seed = 1;
+  char const *LevelPath = NULL;
+  char const *RecordPath = NULL;
+  char const *ReplayPath = NULL;
+  u64 SeekTick = 0;
+  u64 HashInterval = REPLAY_HASH_INTERVAL;
+  int RewindFrames = 0;
+  int RewindMegabytes = 64;
+
+  int DumpFrameCount = 0;
+  int DumpFrames[64];
+
+  for (int i = 1; i < argc; i++) {
+    char const *Option = argv[i];
+    char const *Value = (i + 1 < argc) ? argv[i + 1] : NULL;
+    if (Value == NULL) {
+      fprintf(stderr, "%s needs a value\n", Option);
+      return 1;
+    }
+    i++;
+
+    if (strcmp(Option, "--game") == 0) {
+      snprintf(GamePath, PATH_MAX, "%s", Value);
+    } else if (strcmp(Option, "--data") == 0) {
+      snprintf(gDataDir, PATH_MAX, "%s", Value);
+    } else if (strcmp(Option, "--script") == 0) {
+      ScriptPath = Value;
+    } else if (strcmp(Option, "--frames") == 0) {
+      FrameCount = atoi(Value);
+      FrameCountGiven = true;
+    } else if (strcmp(Option, "--ticks") == 0) {
+      TicksPerFrame = atoi(Value);
+    } else if (strcmp(Option, "--render-every") == 0) {
+      RenderEvery = atoi(Value);
+    } else if (strcmp(Option, "--width") == 0) {
+      Width = atoi(Value);
+    } else if (strcmp(Option, "--height") == 0) {
+      Height = atoi(Value);
+    } else if (strcmp(Option, "--scale") == 0) {
+      RenderScale = atoi(Value);
+      if (!IsValidRenderScale(RenderScale)) {
+        fprintf(stderr, "--scale has to be 1 or 2\n");
+        return 1;
+      }
+    } else if (strcmp(Option, "--huge-pages") == 0) {
+      gUseHugePages = atoi(Value) != 0;
+    } else if (strcmp(Option, "--threads") == 0) {
+      ThreadCount = atoi(Value);
+    } else if (strcmp(Option, "--dump") == 0) {
+      if (DumpFrameCount < (int)COUNT_OF(DumpFrames)) {
+        DumpFrames[DumpFrameCount++] = atoi(Value);
+      }
+    } else if (strcmp(Option, "--dump-dir") == 0) {
+      DumpDir = Value;
+    } else if (strcmp(Option, "--level") == 0) {
+      StartLevel = atoi(Value);
+    } else if (strcmp(Option, "--level-file") == 0) {
+      LevelPath = Value;
+    } else if (strcmp(Option, "--batch") == 0) {
+      BatchSize = atoi(Value);
+    } else if (strcmp(Option, "--seed") == 0) {
+      Seed = strtoull(Value, NULL, 10);
+    } else if (strcmp(Option, "--record") == 0) {
+      RecordPath = Value;
+    } else if (strcmp(Option, "--hash-every") == 0) {
+      HashInterval = strtoull(Value, NULL, 10);
+    } else if (strcmp(Option, "--replay") == 0) {
+      ReplayPath = Value;
+    } else if (strcmp(Option, "--seek") == 0) {
+      SeekTick = strtoull(Value, NULL, 10);
+    } else if (strcmp(Option, "--rewind") == 0) {
+      RewindFrames = atoi(Value);
+    } else if (strcmp(Option, "--rewind-memory") == 0) {
+      RewindMegabytes = atoi(Value);
+    } else {
+      fprintf(stderr, "Unknown option %s\n", Option);
+      return 1;
+    }
+  }
+
+  // Load game code
+  void *Library = dlopen(GamePath, RTLD_NOW);
+  if (Library == NULL) {
+    fprintf(stderr, "Could not load game code: %s\n", dlerror());
+    return 1;
+  }
+  game_update_and_render *UpdateAndRender =
+      (game_update_and_render *)dlsym(Library, "GameUpdateAndRender");
+  if (UpdateAndRender == NULL) {
+    fprintf(stderr, "Could not find GameUpdateAndRender: %s\n", dlerror());
+    return 1;
+  }
+  game_save_state *SaveState =
+      (game_save_state *)dlsym(Library, "GameSaveState");
+  game_load_state *LoadState =
+      (game_load_state *)dlsym(Library, "GameLoadState");
+
+  input_script Script = {};
+  if (ScriptPath && !HeadlessLoadScript(&Script, ScriptPath)) {
+    return 1;
+  }
+
+  if (TicksPerFrame > kMaxTicksPerFrame) {
+    fprintf(stderr, "The game runs at most %d ticks per frame\n",
+            kMaxTicksPerFrame);
+    TicksPerFrame = kMaxTicksPerFrame;
+  }
+  r32 TargetSecondsPerFrame = (r32)TicksPerFrame / (r32)kTicksPerSecond;
+
+  if (StartLevel < 1 || StartLevel > kPlayableLevelCount) {
+    fprintf(stderr, "--level has to be from 1 to %d\n", kPlayableLevelCount);
+    return 1;
+  }
+
+  char *LevelText = NULL;
+  i64 LevelArenaSize = 0;
+  if (LevelPath) {
+    LevelText = HeadlessLoadLevelFile(LevelPath, &LevelArenaSize);
+    if (LevelText == NULL) {
+      return 1;
+    }
+  }
+
+  replay_playback Playback = {};
+  if (ReplayPath) {
+    if (!HeadlessLoadReplay(&Playback, ReplayPath)) {
+      return 1;
+    }
+    StartLevel = Playback.Header.StartLevel + 1;
+    Seed = Playback.Header.RandomSeed;
+    if (!FrameCountGiven || (u64)FrameCount > Playback.Header.FrameCount) {
+      FrameCount = (int)Playback.Header.FrameCount;
+    }
+  }
+
+  if (BatchSize > 0) {
+    batch_work Work = {};
+    Work.UpdateAndRender = UpdateAndRender;
+    Work.Script = ScriptPath ? &Script : NULL;
+    Work.LevelText = LevelText;
+    // Enough for the level arena to hold the level, narrow or tall ones
+    // need more than their tile count suggests
+    Work.MemorySize = 64 * 1024 * 1024;
+    while (GetLevelArenaShare(Work.MemorySize) < LevelArenaSize) {
+      Work.MemorySize *= 2;
+    }
+    Work.Seed = Seed;
+    Work.FrameCount = FrameCount;
+    Work.SecondsPerFrame = TargetSecondsPerFrame;
+    Work.GameCount = BatchSize;
+    Work.Games = (batch_game *)calloc(BatchSize, sizeof(batch_game));
+    if (ThreadCount < 0) {
+      ThreadCount = 0;
+    }
+    for (int i = 0; i < BatchSize; i++) {
+      Work.Games[i].StartLevel = (StartLevel - 1 + i) % kPlayableLevelCount;
+    }
+
+    HeadlessRunBatch(&Work, ThreadCount);
+    return 0;
+  }
+
+  // Init game memory
+  game_memory GameMemory = {};
+  {
+    // Reserved, the game commits what it uses
+    GameMemory.MemorySize = 1024 * 1024 * 1024;  // 1 Gigabyte
+    GameMemory.Start = LinuxReserveMemory(GameMemory.MemorySize);
+    if (GameMemory.Start == NULL) {
+      fprintf(stderr, "Cannot reserve game memory\n");
+      return 1;
+    }
+    GameMemory.Free = GameMemory.Start;
+    GameMemory.PlatformCommitMemory = LinuxCommitMemory;
+    GameMemory.IsInitialized = true;
+    GameMemory.RenderScale = RenderScale;
+    GameMemory.StartLevel = StartLevel - 1;
+    GameMemory.LevelText = LevelText;
+    GameMemory.RandomSeed = Seed;
+
+    GameMemory.DEBUGPlatformReadEntireFile = HeadlessReadEntireFile;
+  }
+
+  platform_work_queue RenderQueue = {};
+  if (ThreadCount > 0) {
+    LinuxMakeQueue(&RenderQueue, ThreadCount);
+
+    GameMemory.RenderQueue = &RenderQueue;
+    GameMemory.PlatformAddEntry = LinuxAddEntry;
+    GameMemory.PlatformCompleteAllWork = LinuxCompleteAllWork;
+  }
+
+  // Init backbuffer
+  game_offscreen_buffer GameBackBuffer = {};
+  GameBackBuffer.Width = Width;
+  GameBackBuffer.Height = Height;
+  GameBackBuffer.MaxWidth = Width;
+  GameBackBuffer.MaxHeight = Height;
+  GameBackBuffer.BytesPerPixel = 4;
+  GameBackBuffer.Memory = calloc(1, Width * Height * 4);
+
+  platform_sound_output SoundOutput = {};
+
+  game_input Input[2] = {};
+  game_input *OldInput = &Input[0];
+  game_input *NewInput = &Input[1];
+
+  replay_recording Recording = {};
+  if (RecordPath) {
+    ReplayBeginRecording(&Recording, GameMemory.StartLevel,
+                         GameMemory.RandomSeed);
+    Recording.HashInterval = HashInterval;
+  }
+
+  int Frame = 0;
+  if (ReplayPath && SeekTick > 0) {
+    u64 SeekStart = HeadlessGetWallClock();
+    if (!ReplaySeek(&Playback, SeekTick, &GameMemory, NewInput, &SoundOutput,
+                    LoadState, UpdateAndRender)) {
+      fprintf(stderr, "Cannot seek in %s\n", ReplayPath);
+      return 1;
+    }
+    Frame = (int)Playback.FramesPlayed;
+    printf("seeked to frame %d, tick %llu in %.3fms\n", Frame,
+           (unsigned long long)Playback.TicksPlayed,
+           (r64)(HeadlessGetWallClock() - SeekStart) / 1.0e6);
+
+    if (Frame >= FrameCount) {
+      // Nothing left to play, only show where it got to
+      NewInput->TickCount = 0;
+      NewInput->dtForFrame = 0;
+      UpdateAndRender(NewInput, &GameBackBuffer, &GameMemory, &SoundOutput,
+                      false);
+    }
+  }
+
+  rewind_buffer Rewind = {};
+  if (RewindFrames > 0) {
+    // One more for where the game is at the end
+    RewindInit(&Rewind, RewindMegabytes * 1024 * 1024, RewindFrames + 1);
+  }
+
+  u64 StartTime = HeadlessGetWallClock();
+
+  for (; Frame < FrameCount; Frame++) {
+    if (ReplayPath) {
+      bool32 WasDesynced = Playback.Desynced;
+      bool32 IsOver = !ReplayNextFrame(&Playback, NewInput, &GameMemory);
+      if (Playback.Desynced && !WasDesynced) {
+        printf("replay desynced between tick %llu and %llu\n",
+               (unsigned long long)Playback.LastGoodTick,
+               (unsigned long long)Playback.DesyncTick);
+      }
+      if (IsOver) {
+        break;
+      }
+    } else {
+      HeadlessApplyScript(&Script, Frame, NewInput);
+    }
+    NewInput->dtForFrame = TargetSecondsPerFrame;
+    game_input RecordedInput = *NewInput;
+    u64 TicksBefore = GameMemory.Stats.Ticks;
+
+    bool32 Dump = false;
+    for (int i = 0; i < DumpFrameCount; i++) {
+      if (DumpFrames[i] == Frame) {
+        Dump = true;
+      }
+    }
+    bool32 Render = Dump || Frame == FrameCount - 1 ||
+                    (RenderEvery > 0 && Frame % RenderEvery == 0);
+
+    // The game only simulates when there's no buffer
+    bool32 RedrawLevel = false;
+    int Quit = UpdateAndRender(NewInput, Render ? &GameBackBuffer : NULL,
+                               &GameMemory, &SoundOutput, RedrawLevel);
+    if (RecordPath) {
+      ReplayRecordFrame(&Recording, &RecordedInput,
+                        (int)(GameMemory.Stats.Ticks - TicksBefore));
+      ReplayRecordKeyframe(&Recording, &GameMemory, SaveState);
+      ReplayRecordHash(&Recording, &GameMemory);
+    }
+    if (RewindFrames > 0 && GameMemory.Stats.Ticks != TicksBefore) {
+      RewindSave(&Rewind, &GameMemory, SaveState);
+    }
+
+    if (Dump) {
+      char Path[PATH_MAX];
+      snprintf(Path, PATH_MAX, "%s/frame_%06d.ppm", DumpDir, Frame);
+      HeadlessWritePPM(Path, &GameBackBuffer);
+    }
+
+    HeadlessSwapInputs(&OldInput, &NewInput);
+
+    if (Quit) {
+      Frame++;
+      break;
+    }
+  }
+
+  if (ReplayPath && Playback.Run.FrameCount == 0) {
+    // The hash after the last frame
+    ReplayReadRun(&Playback, &GameMemory);
+  }
+
+  u64 Elapsed = HeadlessGetWallClock() - StartTime;
+  r64 Seconds = (r64)Elapsed / 1.0e9;
+  if (RecordPath && !HeadlessSaveReplay(&Recording, RecordPath)) {
+    return 1;
+  }
+
+  printf("frames: %d, ticks: %llu\n", Frame,
+         (unsigned long long)GameMemory.Stats.Ticks);
+  printf("time: %.3fs, %.3fms per frame\n", Seconds,
+         Frame ? Seconds * 1000.0 / Frame : 0.0);
+
+  if (RewindFrames > 0) {
+    int KeptFrames = Rewind.SnapshotCount;
+    int KeptSize = Rewind.Used;
+    u64 RewindStart = HeadlessGetWallClock();
+    int Rewound = 0;
+    while (Rewound < RewindFrames &&
+           RewindStep(&Rewind, &GameMemory, LoadState)) {
+      Rewound++;
+    }
+    r64 RewindSeconds = (r64)(HeadlessGetWallClock() - RewindStart) / 1.0e9;
+
+    NewInput->TickCount = 0;
+    NewInput->dtForFrame = 0;
+    UpdateAndRender(NewInput, &GameBackBuffer, &GameMemory, &SoundOutput,
+                    false);
+
+    printf("rewind: kept %d frames in %.1fKB of %dMB, %.0f bytes per frame\n",
+           KeptFrames, KeptSize / 1024.0, RewindMegabytes,
+           KeptFrames ? (r64)KeptSize / KeptFrames : 0.0);
+    printf("rewound %d frames to tick %llu in %.3fms\n", Rewound,
+           (unsigned long long)GameMemory.Stats.Ticks, RewindSeconds * 1000.0);
+  }
+  for (int i = 0; i < GameArena_Count; i++) {
+    memory_arena *Arena = &GameMemory.Arenas[i];
+    printf("%s arena: %.1fKB at most, of %.1fMB\n", kGameArenaNames[i],
+           Arena->HighWater / 1024.0, Arena->Size / (1024.0 * 1024.0));
+  }
+#if BUILD_INTERNAL
+  printf("memory: %.1fMB committed of %dMB reserved, %.1fMB resident\n",
+         (r64)gMemoryCommitted / (1024.0 * 1024.0),
+         GameMemory.MemorySize / (1024 * 1024),
+         (r64)LinuxGetResidentBytes() / (1024.0 * 1024.0));
+#endif
+  printf("last rendered frame hash: %016llx\n",
+         (unsigned long long)HeadlessHashBuffer(&GameBackBuffer));
+
+  if (ReplayPath) {
+    printf("replay hashes: %llu checked, ",
+           (unsigned long long)Playback.HashesChecked);
+    if (Playback.Desynced) {
+      printf("desynced between tick %llu and %llu\n",
+             (unsigned long long)Playback.LastGoodTick,
+             (unsigned long long)Playback.DesyncTick);
+      return 2;
+    }
+    printf("all match\n");
+  }
+
+  return 0;
+}
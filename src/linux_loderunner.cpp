@@ -3,28 +3,78 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xos.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>  // usleep
 #include <time.h>
+#include <errno.h>
 #include <limits.h>
 
 #include "loderunner.h"
+#include "linux_work_queue.cpp"
+#include "linux_memory.cpp"
+#include "loderunner_replay.cpp"
+#include "loderunner_rewind.cpp"
 
 struct linux_game_code {
   void *Library;
   game_update_and_render *UpdateAndRender;
+  game_save_state *SaveState;  // NULL if the game can't do it
+  game_load_state *LoadState;
   bool32 IsValid;
 };
 
 global bool GlobalRunning;
 
 global game_memory GameMemory;
-global game_offscreen_buffer GameBackBuffer;
 global platform_sound_output gSoundOutput;
-global XImage *gXImage;
+global bool32 gXErrorOccurred;
+
+#define PRESENT_BUFFER_COUNT 3
+
+struct linux_present_buffer {
+  XImage *Image;
+  XShmSegmentInfo ShmInfo;
+  game_offscreen_buffer Buffer;  // points into the image
+};
+
+// Frames are presented by a separate thread on its own X connection, so
+// the game can build the next frame while the last one is being uploaded.
+// There are three buffers: the game always draws into one that's neither
+// waiting to be shown nor being shown. A new frame replaces the waiting
+// one if the present thread hasn't picked it up yet.
+//
+// MIT-SHM is used when possible. When the extension is not available
+// (e.g. remote displays) the images are sent through the socket.
+struct linux_presenter {
+  Display *XDisplay;
+  Window XWindow;
+  GC Gc;
+  int Width;
+  int Height;
+  bool32 UseShm;
+  int ShmCompletionEvent;
+
+  linux_present_buffer Buffers[PRESENT_BUFFER_COUNT];
+
+  pthread_t Thread;
+  pthread_mutex_t Mutex;
+  pthread_cond_t FrameReady;
+  bool32 Running;
+  int DrawingIndex;     // -1 when not drawing
+  int ReadyIndex;       // -1 when there's no new frame
+  int PresentingIndex;  // -1 when idle
+
+  u32 FramesPresented;  // these two are under Mutex as well
+  u32 FramesReplaced;
+};
 
 internal void LinuxGetExeDir(char *PathToExe) {
   readlink("/proc/self/exe", PathToExe, PATH_MAX);
@@ -46,7 +96,7 @@ DEBUG_PLATFORM_READ_ENTIRE_FILE(DEBUGPlatformReadEntireFile) {
   LinuxGetExeDir(PathToExe);
 
   char FilePath[PATH_MAX];
-  sprintf(FilePath, "%sdata/%s", PathToExe, Filename)
+  sprintf(FilePath, "%sdata/%s", PathToExe, Filename);
 
   FILE *f = fopen(FilePath, "rb");
   if (f == NULL) {
@@ -66,16 +116,403 @@ DEBUG_PLATFORM_READ_ENTIRE_FILE(DEBUGPlatformReadEntireFile) {
   return Result;
 }
 
+internal bool32 LinuxLoadReplay(replay_playback *Playback, char const *Path) {
+  FILE *f = fopen(Path, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot open replay %s\n", Path);
+    return false;
+  }
+  fseek(f, 0, SEEK_END);
+  long FileSize = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  // Stays around for as long as the replay plays
+  void *File = malloc(FileSize > 0 ? FileSize : 1);
+  bool32 Result = fread(File, 1, FileSize, f) == (size_t)FileSize &&
+                  ReplayBeginPlayback(Playback, File, (int)FileSize);
+  fclose(f);
+
+  if (!Result) {
+    fprintf(stderr, "%s is not a replay this version can play\n", Path);
+  }
+  return Result;
+}
+
+internal void LinuxSaveReplay(replay_recording *Recording, char const *Path) {
+  ReplayEndRecording(Recording);
+
+  FILE *f = fopen(Path, "wb");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot write replay %s\n", Path);
+    return;
+  }
+  fwrite(&Recording->Header, sizeof(Recording->Header), 1, f);
+  fwrite(Recording->Data, Recording->Size, 1, f);
+  fclose(f);
+}
+
+#if BUILD_INTERNAL
+internal void LinuxHandleDebugCycleCounters(game_memory *Memory) {
+  const char *Names[DebugCycleCounter_Count] = {
+      "GameUpdateAndRender", "SortRenderEntries", "RenderGroupToOutput",
+      "UpscaleToOutput",
+  };
+
+  printf("DEBUG CYCLE COUNTS:\n");
+  for (int i = 0; i < DebugCycleCounter_Count; i++) {
+    debug_cycle_counter *Counter = &Memory->Counters[i];
+    if (Counter->HitCount) {
+      printf("  %s: %llucy %uh %llucy/h\n", Names[i],
+             (unsigned long long)Counter->CycleCount, Counter->HitCount,
+             (unsigned long long)(Counter->CycleCount / Counter->HitCount));
+      Counter->CycleCount = 0;
+      Counter->HitCount = 0;
+    }
+  }
+}
+#endif
+
+// Nanoseconds since some point in the past, never wraps
 inline u64 LinuxGetWallClock() {
-  u64 result = 0;
   struct timespec spec;
-
   clock_gettime(CLOCK_MONOTONIC, &spec);
-  result = spec.tv_nsec;  // ns
 
+  u64 result = (u64)spec.tv_sec * 1000000000ull + (u64)spec.tv_nsec;
   return result;
 }
 
+#define FRAME_HISTOGRAM_BUCKET_COUNT 34
+
+// Sleeps until absolute deadlines one frame apart, so time spent
+// in the frame itself doesn't add up. The scheduler may wake us up late,
+// so optionally we wake up SpinNanoseconds early and spin the rest.
+struct linux_frame_pacer {
+  u64 TargetNanoseconds;
+  u64 SpinNanoseconds;
+  u64 NextDeadline;
+  u64 LastFrameEnd;
+
+  // Counted, never reset
+  u64 FrameCount;
+  u64 MissedFrames;  // whole frames past the deadline
+  u64 LongestFrame;  // ns
+
+  // Frame times in 1 ms buckets, the last one is for anything longer
+  u32 Histogram[FRAME_HISTOGRAM_BUCKET_COUNT];
+};
+
+internal void LinuxInitFramePacer(linux_frame_pacer *Pacer, int TargetFPS,
+                                  u64 SpinNanoseconds) {
+  *Pacer = {};
+  Pacer->TargetNanoseconds = 1000000000ull / (u64)TargetFPS;
+  Pacer->SpinNanoseconds = SpinNanoseconds;
+  if (Pacer->SpinNanoseconds > Pacer->TargetNanoseconds / 2) {
+    Pacer->SpinNanoseconds = Pacer->TargetNanoseconds / 2;
+  }
+
+  u64 Now = LinuxGetWallClock();
+  Pacer->NextDeadline = Now + Pacer->TargetNanoseconds;
+  Pacer->LastFrameEnd = Now;
+}
+
+internal void LinuxSleepUntil(u64 Deadline) {
+  struct timespec ts;
+  ts.tv_sec = (time_t)(Deadline / 1000000000ull);
+  ts.tv_nsec = (long)(Deadline % 1000000000ull);
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    // Interrupted by a signal, the deadline is still the same
+  }
+}
+
+internal void LinuxWaitForNextFrame(linux_frame_pacer *Pacer) {
+  u64 Now = LinuxGetWallClock();
+
+  if (Now < Pacer->NextDeadline) {
+    u64 WakeUp = Pacer->NextDeadline - Pacer->SpinNanoseconds;
+    if (Now < WakeUp) {
+      LinuxSleepUntil(WakeUp);
+    }
+
+    // Bounded by SpinNanoseconds unless the sleep overshot
+    while ((Now = LinuxGetWallClock()) < Pacer->NextDeadline) {
+    }
+    Pacer->NextDeadline += Pacer->TargetNanoseconds;
+  } else {
+    // Too late. Don't try to catch up, start counting from now.
+    Pacer->MissedFrames +=
+        1 + (Now - Pacer->NextDeadline) / Pacer->TargetNanoseconds;
+    Pacer->NextDeadline = Now + Pacer->TargetNanoseconds;
+  }
+
+  u64 FrameTime = Now - Pacer->LastFrameEnd;
+  Pacer->LastFrameEnd = Now;
+  Pacer->FrameCount++;
+  if (FrameTime > Pacer->LongestFrame) {
+    Pacer->LongestFrame = FrameTime;
+  }
+
+  u64 Bucket = FrameTime / 1000000ull;
+  if (Bucket >= FRAME_HISTOGRAM_BUCKET_COUNT) {
+    Bucket = FRAME_HISTOGRAM_BUCKET_COUNT - 1;
+  }
+  Pacer->Histogram[Bucket]++;
+}
+
+#if BUILD_INTERNAL
+internal void LinuxPrintFramePacerStats(linux_frame_pacer *Pacer) {
+  printf("FRAME TIMES (%llu frames, %llu missed, longest %.2fms):\n",
+         (unsigned long long)Pacer->FrameCount,
+         (unsigned long long)Pacer->MissedFrames,
+         (r64)Pacer->LongestFrame / 1.0e6);
+  for (int i = 0; i < FRAME_HISTOGRAM_BUCKET_COUNT; i++) {
+    if (Pacer->Histogram[i]) {
+      bool32 IsLast = (i == FRAME_HISTOGRAM_BUCKET_COUNT - 1);
+      printf("  %s%2dms: %u\n", IsLast ? ">=" : "", i, Pacer->Histogram[i]);
+    }
+  }
+}
+#endif
+
+internal int LinuxTrapXError(Display *display, XErrorEvent *event) {
+  gXErrorOccurred = true;
+  return 0;
+}
+
+internal XImage *LinuxCreateShmImage(Display *display, Visual *visual,
+                                     int depth, int Width, int Height,
+                                     XShmSegmentInfo *ShmInfo) {
+  if (!XShmQueryExtension(display)) {
+    return NULL;
+  }
+
+  XImage *Image = XShmCreateImage(display, visual, depth, ZPixmap, 0,
+                                  ShmInfo, Width, Height);
+  if (Image == NULL) {
+    return NULL;
+  }
+
+  ShmInfo->shmid =
+      shmget(IPC_PRIVATE, Image->bytes_per_line * Image->height, IPC_CREAT | 0600);
+  if (ShmInfo->shmid < 0) {
+    XDestroyImage(Image);
+    return NULL;
+  }
+
+  ShmInfo->shmaddr = (char *)shmat(ShmInfo->shmid, 0, 0);
+  if (ShmInfo->shmaddr == (char *)-1) {
+    shmctl(ShmInfo->shmid, IPC_RMID, 0);
+    XDestroyImage(Image);
+    return NULL;
+  }
+  Image->data = ShmInfo->shmaddr;
+  ShmInfo->readOnly = False;
+
+  // The extension may be advertised even when the server can't actually
+  // attach to our segment (remote displays), so trap the error
+  gXErrorOccurred = false;
+  XErrorHandler OldHandler = XSetErrorHandler(LinuxTrapXError);
+  XShmAttach(display, ShmInfo);
+  XSync(display, False);
+  XSetErrorHandler(OldHandler);
+
+  // The segment goes away once both we and the server have detached
+  shmctl(ShmInfo->shmid, IPC_RMID, 0);
+
+  if (gXErrorOccurred) {
+    shmdt(ShmInfo->shmaddr);
+    Image->data = NULL;
+    XDestroyImage(Image);
+    return NULL;
+  }
+
+  return Image;
+}
+
+internal Bool LinuxIsShmCompletion(Display *display, XEvent *event,
+                                   XPointer arg) {
+  linux_presenter *Presenter = (linux_presenter *)arg;
+  return event->type == Presenter->ShmCompletionEvent;
+}
+
+// Returns when the buffer can be drawn into again
+internal void LinuxPresentBuffer(linux_presenter *Presenter,
+                                 linux_present_buffer *Buffer) {
+  if (Presenter->UseShm) {
+    XShmPutImage(Presenter->XDisplay, Presenter->XWindow, Presenter->Gc,
+                 Buffer->Image, 0, 0, 0, 0, Presenter->Width,
+                 Presenter->Height, True);
+    XFlush(Presenter->XDisplay);
+
+    // Don't touch the shared image while the server is still reading it
+    XEvent event;
+    XIfEvent(Presenter->XDisplay, &event, LinuxIsShmCompletion,
+             (XPointer)Presenter);
+  } else {
+    // The pixels are copied into the request, nothing to wait for
+    XPutImage(Presenter->XDisplay, Presenter->XWindow, Presenter->Gc,
+              Buffer->Image, 0, 0, 0, 0, Presenter->Width, Presenter->Height);
+    XFlush(Presenter->XDisplay);
+  }
+}
+
+internal void *LinuxPresentThreadProc(void *Parameter) {
+  linux_presenter *Presenter = (linux_presenter *)Parameter;
+
+  pthread_mutex_lock(&Presenter->Mutex);
+  for (;;) {
+    while (Presenter->Running && Presenter->ReadyIndex < 0) {
+      pthread_cond_wait(&Presenter->FrameReady, &Presenter->Mutex);
+    }
+    if (!Presenter->Running) break;
+
+    int Index = Presenter->ReadyIndex;
+    Presenter->ReadyIndex = -1;
+    Presenter->PresentingIndex = Index;
+    pthread_mutex_unlock(&Presenter->Mutex);
+
+    LinuxPresentBuffer(Presenter, &Presenter->Buffers[Index]);
+
+    pthread_mutex_lock(&Presenter->Mutex);
+    Presenter->PresentingIndex = -1;
+    Presenter->FramesPresented++;
+  }
+  pthread_mutex_unlock(&Presenter->Mutex);
+
+  return NULL;
+}
+
+internal bool32 LinuxInitPresenter(linux_presenter *Presenter, Window window,
+                                   int Width, int Height, int MaxWidth,
+                                   int MaxHeight) {
+  Presenter->XDisplay = XOpenDisplay(0);
+  if (Presenter->XDisplay == NULL) {
+    return false;
+  }
+
+  Display *display = Presenter->XDisplay;
+  int screen = DefaultScreen(display);
+  Visual *visual = DefaultVisual(display, screen);
+  int depth = DefaultDepth(display, screen);
+
+  XGCValues gcvalues;
+  Presenter->XWindow = window;
+  Presenter->Gc = XCreateGC(display, window, 0, &gcvalues);
+  Presenter->Width = Width;
+  Presenter->Height = Height;
+
+  // Either all buffers use SHM or none
+  Presenter->UseShm = true;
+  for (int i = 0; i < PRESENT_BUFFER_COUNT; i++) {
+    linux_present_buffer *Buffer = &Presenter->Buffers[i];
+    Buffer->Image = LinuxCreateShmImage(display, visual, depth, Width, Height,
+                                        &Buffer->ShmInfo);
+    if (Buffer->Image == NULL) {
+      for (int j = 0; j < i; j++) {
+        linux_present_buffer *Created = &Presenter->Buffers[j];
+        XShmDetach(display, &Created->ShmInfo);
+        shmdt(Created->ShmInfo.shmaddr);
+        Created->Image->data = NULL;
+        XDestroyImage(Created->Image);
+        Created->Image = NULL;
+      }
+      Presenter->UseShm = false;
+      break;
+    }
+  }
+
+  if (Presenter->UseShm) {
+    Presenter->ShmCompletionEvent = XShmGetEventBase(display) + ShmCompletion;
+  } else {
+    printf("MIT-SHM is not available, using XPutImage\n");
+
+    for (int i = 0; i < PRESENT_BUFFER_COUNT; i++) {
+      void *BufferMemory = malloc(Width * Height * 4);
+
+      int bitmap_pad = 32;
+      int bytes_per_line = 0;
+      int offset = 0;
+
+      Presenter->Buffers[i].Image =
+          XCreateImage(display, visual, depth, ZPixmap, offset,
+                       (char *)BufferMemory, Width, Height, bitmap_pad,
+                       bytes_per_line);
+    }
+  }
+
+  for (int i = 0; i < PRESENT_BUFFER_COUNT; i++) {
+    linux_present_buffer *Buffer = &Presenter->Buffers[i];
+    Buffer->Buffer = {};
+    Buffer->Buffer.Memory = (void *)Buffer->Image->data;
+    Buffer->Buffer.Width = Width;
+    Buffer->Buffer.Height = Height;
+    Buffer->Buffer.BytesPerPixel = 4;
+    Buffer->Buffer.MaxWidth = MaxWidth;
+    Buffer->Buffer.MaxHeight = MaxHeight;
+
+    // The game assumes the pitch is Width * BytesPerPixel
+    Assert(Buffer->Image->bytes_per_line ==
+           Buffer->Buffer.Width * Buffer->Buffer.BytesPerPixel);
+  }
+
+  Presenter->DrawingIndex = -1;
+  Presenter->ReadyIndex = -1;
+  Presenter->PresentingIndex = -1;
+  Presenter->Running = true;
+  pthread_mutex_init(&Presenter->Mutex, NULL);
+  pthread_cond_init(&Presenter->FrameReady, NULL);
+  pthread_create(&Presenter->Thread, NULL, LinuxPresentThreadProc, Presenter);
+
+  return true;
+}
+
+// The buffer the game should draw the next frame into. The game rewrites
+// all of it every frame, so it doesn't matter what was there before.
+internal game_offscreen_buffer *LinuxBeginFrame(linux_presenter *Presenter) {
+  pthread_mutex_lock(&Presenter->Mutex);
+  int Index = 0;
+  while (Index == Presenter->ReadyIndex ||
+         Index == Presenter->PresentingIndex) {
+    Index++;
+  }
+  Assert(Index < PRESENT_BUFFER_COUNT);
+  Presenter->DrawingIndex = Index;
+  pthread_mutex_unlock(&Presenter->Mutex);
+
+  return &Presenter->Buffers[Index].Buffer;
+}
+
+internal void LinuxEndFrame(linux_presenter *Presenter) {
+  pthread_mutex_lock(&Presenter->Mutex);
+  if (Presenter->ReadyIndex >= 0) {
+    Presenter->FramesReplaced++;
+  }
+  Presenter->ReadyIndex = Presenter->DrawingIndex;
+  Presenter->DrawingIndex = -1;
+  pthread_cond_signal(&Presenter->FrameReady);
+  pthread_mutex_unlock(&Presenter->Mutex);
+}
+
+internal void LinuxShutdownPresenter(linux_presenter *Presenter) {
+  pthread_mutex_lock(&Presenter->Mutex);
+  Presenter->Running = false;
+  pthread_cond_signal(&Presenter->FrameReady);
+  pthread_mutex_unlock(&Presenter->Mutex);
+  pthread_join(Presenter->Thread, NULL);
+
+  for (int i = 0; i < PRESENT_BUFFER_COUNT; i++) {
+    linux_present_buffer *Buffer = &Presenter->Buffers[i];
+    if (Presenter->UseShm) {
+      XShmDetach(Presenter->XDisplay, &Buffer->ShmInfo);
+      shmdt(Buffer->ShmInfo.shmaddr);
+      Buffer->Image->data = NULL;
+    }
+    XDestroyImage(Buffer->Image);
+  }
+  XFreeGC(Presenter->XDisplay, Presenter->Gc);
+  XCloseDisplay(Presenter->XDisplay);
+}
+
 int main(int argc, char const *argv[]) {
   // Load game code
   linux_game_code Game = {};
@@ -96,6 +533,8 @@ int main(int argc, char const *argv[]) {
       } else {
         Game.IsValid = true;
       }
+      Game.SaveState = (game_save_state *)dlsym(Game.Library, "GameSaveState");
+      Game.LoadState = (game_load_state *)dlsym(Game.Library, "GameLoadState");
     }
   }
   if (!Game.IsValid) {
@@ -107,6 +546,9 @@ int main(int argc, char const *argv[]) {
   Window window;
   int screen;
 
+  // The present thread has its own connection, but be safe anyway
+  XInitThreads();
+
   display = XOpenDisplay(0);
   if (display == 0) {
     fprintf(stderr, "Cannot open display\n");
@@ -139,59 +581,58 @@ int main(int argc, char const *argv[]) {
 
   // Init game memory
   {
+    // Reserved, the game commits what it uses
     GameMemory.MemorySize = 1024 * 1024 * 1024;  // 1 Gigabyte
-    GameMemory.Start = malloc(GameMemory.MemorySize);
+    GameMemory.Start = LinuxReserveMemory(GameMemory.MemorySize);
+    if (GameMemory.Start == NULL) {
+      fprintf(stderr, "Cannot reserve game memory\n");
+      return 1;
+    }
     GameMemory.Free = GameMemory.Start;
+    GameMemory.PlatformCommitMemory = LinuxCommitMemory;
     GameMemory.IsInitialized = true;
+    GameMemory.RandomSeed = (u64)time(NULL);
 
     GameMemory.DEBUGPlatformReadEntireFile = DEBUGPlatformReadEntireFile;
-  }
 
-  // Init backbuffer
-  GameBackBuffer.MaxWidth = 2000;
-  GameBackBuffer.MaxHeight = 1500;
-  GameBackBuffer.BytesPerPixel = 4;
-
-  // @tmp
-  GameBackBuffer.Width = kWindowWidth;
-  GameBackBuffer.Height = kWindowHeight;
-
-  int BufferSize = GameBackBuffer.MaxWidth * GameBackBuffer.MaxHeight *
-                   GameBackBuffer.BytesPerPixel;
-
-  GameBackBuffer.Memory = malloc(BufferSize);
+    // --scale N makes game pixels N times bigger than screen pixels
+    for (int i = 1; i + 1 < argc; i++) {
+      if (strcmp(argv[i], "--scale") == 0) {
+        GameMemory.RenderScale = atoi(argv[i + 1]);
+        if (!IsValidRenderScale(GameMemory.RenderScale)) {
+          fprintf(stderr, "--scale has to be 1 or 2\n");
+          return 1;
+        }
+      }
+    }
 
-  Pixmap pixmap;
-  GC gc;
-  XGCValues gcvalues;
+    // --huge-pages backs the memory the game goes through all the time
+    // with transparent huge pages
+    for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--huge-pages") == 0) {
+        gUseHugePages = true;
+      }
+    }
+  }
 
-  // Create x image
+  // Init render threads. The main thread joins in while waiting
+  // for the work to finish, so we need one thread less than cores.
+  platform_work_queue RenderQueue = {};
   {
-    // int depth = 32;
-    // int bitmap_pad = 32;
-    // int bytes_per_line = 0;
-    // int offset = 0;
-
-    // gXImage = XCreateImage(display, CopyFromParent, depth, ZPixmap, offset,
-    //                        (char *)GameBackBuffer.Memory, kWindowWidth,
-    //                        kWindowHeight, bitmap_pad, bytes_per_line);
+    int CoreCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    LinuxMakeQueue(&RenderQueue, CoreCount > 1 ? CoreCount - 1 : 0);
 
-    // TODO: find a way to do it with a newly created image
-    usleep(500000);
-    gXImage = XGetImage(display, window, 0, 0, kWindowWidth, kWindowHeight,
-                        AllPlanes, ZPixmap);
-
-    GameBackBuffer.Memory = (void *)gXImage->data;
-
-    // u32 *Pixel = (u32 *)gXImage->data;
-    // for (int i = 0; i < kWindowWidth * 700; i++) {
-    //   *Pixel = 0x00FF00FF;
-    //   Pixel++;
-    // }
+    GameMemory.RenderQueue = &RenderQueue;
+    GameMemory.PlatformAddEntry = LinuxAddEntry;
+    GameMemory.PlatformCompleteAllWork = LinuxCompleteAllWork;
+  }
 
-    // pixmap = XCreatePixmap(display, window, kWindowWidth,
-    //                        kWindowHeight, depth);
-    gc = XCreateGC(display, window, 0, &gcvalues);
+  // Init presentation
+  linux_presenter Presenter = {};
+  if (!LinuxInitPresenter(&Presenter, window, kWindowWidth, kWindowHeight,
+                          2000, 1500)) {
+    fprintf(stderr, "Cannot open display\n");
+    return 1;
   }
 
   // Get space for inputs
@@ -202,11 +643,94 @@ int main(int argc, char const *argv[]) {
 
   // TODO: query monitor refresh rate
   int target_fps = 60;
-  r32 target_nspf = 1.0e9f / (r32)target_fps;  // Target ms per frame
+
+  // --record FILE saves the input on exit, --replay FILE plays it back
+  // and then hands over to the keyboard. --replay-speed N plays N frames
+  // per frame shown, --seek T starts the replay from tick T.
+  char const *RecordPath = NULL;
+  char const *ReplayPath = NULL;
+  int ReplaySpeed = 1;
+  u64 SeekTick = 0;
+  for (int i = 1; i + 1 < argc; i++) {
+    if (strcmp(argv[i], "--record") == 0) {
+      RecordPath = argv[i + 1];
+    } else if (strcmp(argv[i], "--replay") == 0) {
+      ReplayPath = argv[i + 1];
+    } else if (strcmp(argv[i], "--replay-speed") == 0) {
+      ReplaySpeed = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--seek") == 0) {
+      SeekTick = strtoull(argv[i + 1], NULL, 10);
+    }
+  }
+  if (ReplaySpeed < 1) {
+    ReplaySpeed = 1;
+  }
+
+  replay_playback Playback = {};
+  bool32 Replaying = false;
+  if (ReplayPath) {
+    if (!LinuxLoadReplay(&Playback, ReplayPath)) {
+      return 1;
+    }
+    GameMemory.StartLevel = Playback.Header.StartLevel;
+    GameMemory.RandomSeed = Playback.Header.RandomSeed;
+    Replaying = true;
+    if (RecordPath) {
+      fprintf(stderr, "Not recording while replaying\n");
+      RecordPath = NULL;
+    }
+    if (SeekTick > 0 &&
+        !ReplaySeek(&Playback, SeekTick, &GameMemory, NewInput, &gSoundOutput,
+                    Game.LoadState, Game.UpdateAndRender)) {
+      fprintf(stderr, "Cannot seek in %s, playing from the start\n",
+              ReplayPath);
+    }
+  }
+
+  replay_recording Recording = {};
+  if (RecordPath) {
+    ReplayBeginRecording(&Recording, GameMemory.StartLevel,
+                         GameMemory.RandomSeed);
+  }
+
+  // --spin N wakes up N microseconds before the deadline and spins
+  u64 spin_ns = 0;
+  for (int i = 1; i + 1 < argc; i++) {
+    if (strcmp(argv[i], "--spin") == 0) {
+      spin_ns = (u64)atoi(argv[i + 1]) * 1000;
+    }
+  }
+
+  // Holding backspace goes back in time. --rewind N keeps the last
+  // N seconds (30), --rewind-memory M at most M megabytes of them (64).
+  // Not while recording, the replay would no longer match.
+  rewind_buffer Rewind = {};
+  bool32 Rewinding = false;
+  {
+    int RewindSeconds = 30;
+    int RewindMegabytes = 64;
+    for (int i = 1; i + 1 < argc; i++) {
+      if (strcmp(argv[i], "--rewind") == 0) {
+        RewindSeconds = atoi(argv[i + 1]);
+      } else if (strcmp(argv[i], "--rewind-memory") == 0) {
+        RewindMegabytes = atoi(argv[i + 1]);
+      }
+    }
+    if (!RecordPath && RewindSeconds > 0 && RewindMegabytes > 0) {
+      RewindInit(&Rewind, RewindMegabytes * 1024 * 1024,
+                 RewindSeconds * target_fps);
+    }
+  }
 
   GlobalRunning = true;
 
-  u64 last_timestamp = LinuxGetWallClock();
+  linux_frame_pacer Pacer;
+  LinuxInitFramePacer(&Pacer, target_fps, spin_ns);
+  u64 LastFrameStart = LinuxGetWallClock() - Pacer.TargetNanoseconds;
+
+#if BUILD_INTERNAL
+  int DebugFrameCount = 0;
+#endif
 
   while (GlobalRunning) {
     // Process events
@@ -268,6 +792,8 @@ int main(int argc, char const *argv[]) {
           Player1->Fire.EndedDown = pressed;
         } else if (symbol == 'x') {
           Player1->Turbo.EndedDown = pressed;
+        } else if (key == XK_BackSpace) {
+          Rewinding = pressed;
         }
       }
 
@@ -281,8 +807,90 @@ int main(int argc, char const *argv[]) {
 
     bool32 RedrawLevel = false;
 
-    Game.UpdateAndRender(NewInput, &GameBackBuffer, &GameMemory, &gSoundOutput,
-                         RedrawLevel);
+    // The game catches up with however much time has actually passed
+    u64 FrameStart = LinuxGetWallClock();
+    r32 dtForFrame = (r32)(FrameStart - LastFrameStart) / 1.0e9f;
+    LastFrameStart = FrameStart;
+
+    int Result = 0;
+    if (Replaying) {
+      // The replay sets the input and the ticks. Frames beyond
+      // the first one are only simulated, the last one gets shown.
+      for (int i = 0; i < ReplaySpeed && Replaying; i++) {
+        bool32 WasDesynced = Playback.Desynced;
+        Replaying = ReplayNextFrame(&Playback, NewInput, &GameMemory);
+        if (Playback.Desynced && !WasDesynced) {
+          printf("Replay desynced between tick %llu and %llu\n",
+                 (unsigned long long)Playback.LastGoodTick,
+                 (unsigned long long)Playback.DesyncTick);
+        }
+        if (Replaying && i < ReplaySpeed - 1 && Result == 0) {
+          Result = Game.UpdateAndRender(NewInput, NULL, &GameMemory,
+                                        &gSoundOutput, RedrawLevel);
+        }
+      }
+      if (!Replaying) {
+        printf("Replay finished\n");
+        *NewInput = {};
+      }
+    }
+    NewInput->dtForFrame = dtForFrame;
+    if (Rewinding && !Replaying && !RecordPath) {
+      // Go one frame back and only show it
+      RewindStep(&Rewind, &GameMemory, Game.LoadState);
+      NewInput->dtForFrame = 0;
+    }
+
+    game_input RecordedInput = *NewInput;
+    u64 TicksBefore = GameMemory.Stats.Ticks;
+
+    game_offscreen_buffer *Buffer = LinuxBeginFrame(&Presenter);
+    if (Result == 0) {
+      Result = Game.UpdateAndRender(NewInput, Buffer, &GameMemory,
+                                    &gSoundOutput, RedrawLevel);
+    }
+    LinuxEndFrame(&Presenter);
+    if (Result > 0) {
+      GlobalRunning = false;
+    }
+
+    if (RecordPath) {
+      ReplayRecordFrame(&Recording, &RecordedInput,
+                        (int)(GameMemory.Stats.Ticks - TicksBefore));
+      ReplayRecordKeyframe(&Recording, &GameMemory, Game.SaveState);
+      ReplayRecordHash(&Recording, &GameMemory);
+    }
+    if (!Replaying && GameMemory.Stats.Ticks != TicksBefore) {
+      RewindSave(&Rewind, &GameMemory, Game.SaveState);
+    }
+
+#if BUILD_INTERNAL
+    // Report once a second
+    if (++DebugFrameCount == target_fps) {
+      DebugFrameCount = 0;
+      LinuxHandleDebugCycleCounters(&GameMemory);
+      // The present thread counts them under the lock
+      pthread_mutex_lock(&Presenter.Mutex);
+      u32 FramesPresented = Presenter.FramesPresented;
+      u32 FramesReplaced = Presenter.FramesReplaced;
+      pthread_mutex_unlock(&Presenter.Mutex);
+      printf("  Frames presented: %u, replaced before shown: %u\n",
+             FramesPresented, FramesReplaced);
+      printf("  Rewind: %d frames in %dKB of %dKB\n", Rewind.SnapshotCount,
+             Rewind.Used / 1024, Rewind.MaxSize / 1024);
+      for (int i = 0; i < GameArena_Count; i++) {
+        memory_arena *Arena = &GameMemory.Arenas[i];
+        printf("  Arena %s: %dKB used, at most %dKB of %dKB\n",
+               kGameArenaNames[i], Arena->Used / 1024, Arena->HighWater / 1024,
+               Arena->Size / 1024);
+      }
+      printf("  Memory: %lldKB committed of %dKB reserved, %lldKB resident\n",
+             (long long)gMemoryCommitted / 1024, GameMemory.MemorySize / 1024,
+             (long long)LinuxGetResidentBytes() / 1024);
+      printf("  Frames missed: %llu\n",
+             (unsigned long long)Pacer.MissedFrames);
+    }
+#endif
 
     // Swap inputs
     game_input *TmpInput = OldInput;
@@ -300,31 +908,18 @@ int main(int argc, char const *argv[]) {
       }
     }
 
-    XPutImage(display, window, gc, gXImage, 0, 0, 0, 0, kWindowWidth,
-              kWindowHeight);
-
-    // Limit FPS
-    {
-      u64 current_timestamp = LinuxGetWallClock();
-      u64 ns_elapsed = LinuxGetWallClock() - last_timestamp;
-
-      if (ns_elapsed < target_nspf) {
-        timespec ts;
-        ts.tv_sec = 0;
-        ts.tv_nsec = target_nspf - ns_elapsed;  // time to sleep
-        clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+    LinuxWaitForNextFrame(&Pacer);
+  }
 
-        while (ns_elapsed < target_nspf) {
-          ns_elapsed = LinuxGetWallClock() - last_timestamp;
-        }
-      } else {
-        printf("Frame missed\n");
-      }
+#if BUILD_INTERNAL
+  LinuxPrintFramePacerStats(&Pacer);
+#endif
 
-      last_timestamp = LinuxGetWallClock();
-    }
+  if (RecordPath) {
+    LinuxSaveReplay(&Recording, RecordPath);
   }
 
+  LinuxShutdownPresenter(&Presenter);
   XCloseDisplay(display);
 
   return 0;
@@ -0,0 +1,60 @@
+// Game memory that's reserved up front and committed as the game needs it,
+// shared by the Linux platform layers
+
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "loderunner.h"
+
+// Hot memory gets transparent huge pages if this is set
+global bool32 gUseHugePages;
+global i64 gMemoryCommitted;
+
+// Only address space, none of it can be touched until it's committed.
+// Returns NULL if even that isn't available.
+internal void *LinuxReserveMemory(int Size) {
+  // Get enough to start on a huge page, the rest of the one we skip
+  // over is never used
+  size_t Alignment = kArenaAlignment;
+  u8 *Reserved = (u8 *)mmap(0, Size + Alignment, PROT_NONE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (Reserved == MAP_FAILED) {
+    return NULL;
+  }
+  return (void *)(((uintptr_t)Reserved + Alignment - 1) & ~(Alignment - 1));
+}
+
+internal PLATFORM_COMMIT_MEMORY(LinuxCommitMemory) {
+  // mprotect wants whole pages
+  uintptr_t PageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t First = (uintptr_t)Start & ~(PageSize - 1);
+  uintptr_t End = ((uintptr_t)Start + Size + PageSize - 1) & ~(PageSize - 1);
+  if (mprotect((void *)First, End - First, PROT_READ | PROT_WRITE) != 0) {
+    return false;
+  }
+#ifdef MADV_HUGEPAGE
+  if (IsHot && gUseHugePages) {
+    madvise((void *)First, End - First, MADV_HUGEPAGE);
+  }
+#endif
+  gMemoryCommitted += (i64)(End - First);
+  return true;
+}
+
+#if BUILD_INTERNAL
+// What's actually in memory, as opposed to committed
+internal i64 LinuxGetResidentBytes() {
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f == NULL) {
+    return 0;
+  }
+  long long TotalPages = 0;
+  long long ResidentPages = 0;
+  if (fscanf(f, "%lld %lld", &TotalPages, &ResidentPages) != 2) {
+    ResidentPages = 0;
+  }
+  fclose(f);
+  return (i64)ResidentPages * sysconf(_SC_PAGESIZE);
+}
+#endif
@@ -0,0 +1,97 @@
+// Worker threads for the game, shared by the Linux platform layers
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "loderunner.h"
+
+struct platform_work_queue_entry {
+  platform_work_queue_callback *Callback;
+  void *Data;
+};
+
+struct platform_work_queue {
+  u32 volatile CompletionGoal;
+  u32 volatile CompletionCount;
+
+  u32 volatile NextEntryToWrite;
+  u32 volatile NextEntryToRead;
+  sem_t SemaphoreHandle;
+
+  platform_work_queue_entry Entries[256];
+};
+
+internal PLATFORM_ADD_ENTRY(LinuxAddEntry) {
+  // NOTE: only one thread is supposed to add entries
+  u32 NewNextEntryToWrite =
+      (Queue->NextEntryToWrite + 1) % COUNT_OF(Queue->Entries);
+  Assert(NewNextEntryToWrite != Queue->NextEntryToRead);
+  platform_work_queue_entry *Entry = &Queue->Entries[Queue->NextEntryToWrite];
+  Entry->Callback = Callback;
+  Entry->Data = Data;
+  ++Queue->CompletionGoal;
+  __sync_synchronize();  // the entry must be visible before the index
+  Queue->NextEntryToWrite = NewNextEntryToWrite;
+  sem_post(&Queue->SemaphoreHandle);
+}
+
+internal bool32 LinuxDoNextWorkQueueEntry(platform_work_queue *Queue) {
+  bool32 WeShouldSleep = false;
+
+  u32 OriginalNextEntryToRead = Queue->NextEntryToRead;
+  u32 NewNextEntryToRead =
+      (OriginalNextEntryToRead + 1) % COUNT_OF(Queue->Entries);
+  if (OriginalNextEntryToRead != Queue->NextEntryToWrite) {
+    u32 Index = __sync_val_compare_and_swap(
+        &Queue->NextEntryToRead, OriginalNextEntryToRead, NewNextEntryToRead);
+    if (Index == OriginalNextEntryToRead) {
+      platform_work_queue_entry Entry = Queue->Entries[Index];
+      Entry.Callback(Queue, Entry.Data);
+      __sync_fetch_and_add(&Queue->CompletionCount, 1);
+    }
+  } else {
+    WeShouldSleep = true;
+  }
+
+  return WeShouldSleep;
+}
+
+internal PLATFORM_COMPLETE_ALL_WORK(LinuxCompleteAllWork) {
+  // The calling thread helps out instead of just waiting
+  while (Queue->CompletionGoal != Queue->CompletionCount) {
+    LinuxDoNextWorkQueueEntry(Queue);
+  }
+
+  Queue->CompletionGoal = 0;
+  Queue->CompletionCount = 0;
+}
+
+internal void *LinuxWorkerThreadProc(void *Parameter) {
+  platform_work_queue *Queue = (platform_work_queue *)Parameter;
+
+  for (;;) {
+    if (LinuxDoNextWorkQueueEntry(Queue)) {
+      sem_wait(&Queue->SemaphoreHandle);
+    }
+  }
+
+  return NULL;
+}
+
+internal void LinuxMakeQueue(platform_work_queue *Queue, int ThreadCount) {
+  Queue->CompletionGoal = 0;
+  Queue->CompletionCount = 0;
+  Queue->NextEntryToWrite = 0;
+  Queue->NextEntryToRead = 0;
+
+  sem_init(&Queue->SemaphoreHandle, 0, 0);
+
+  for (int ThreadIndex = 0; ThreadIndex < ThreadCount; ++ThreadIndex) {
+    pthread_t Thread;
+    pthread_attr_t Attr;
+    pthread_attr_init(&Attr);
+    pthread_attr_setdetachstate(&Attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&Thread, &Attr, LinuxWorkerThreadProc, Queue);
+    pthread_attr_destroy(&Attr);
+  }
+}
@@ -1,275 +1,524 @@
+#include <emmintrin.h>
+
 #include "loderunner.h"
 #include "loderunner_levels.cpp"
+#include "loderunner_render.cpp"
 
-// These are saved as global vars on the first call of GameUpdateAndRender
-global game_offscreen_buffer *GameBackBuffer;
-global game_memory *GameMemory;
+#if BUILD_INTERNAL
+thread_local game_memory *DebugGlobalMemory;
+#endif
 
-global bool32 gClock = true;
-global bool32 gDeadWait = 0;
-global bool32 gShowMenu = false;
-global int gSelectedLevel = 1;
-global int gMenuKeyPressCooldown = 0;
+global const int kTileWidth = 32;
+global const int kTileHeight = 32;
+global const int kHumanWidth = 24;
+global const int kHumanHeight = 32;
+global const u32 kBackgroundColor = 0x000A0D0B;
+global const int kLevelsInMenuRow = 5;
+
+// Animations, in the order of person_animation
+global const animation kPlayerAnimations[PersonAnimation_Count] = {
+    {3, {{0, 32, 3}, {24, 32, 2}, {48, 32, 3}}},   // Going left
+    {3, {{0, 0, 3}, {24, 0, 2}, {48, 0, 3}}},      // Going right
+    {2, {{0, 128, 4}, {24, 128, 4}}},              // On ladder
+    {3, {{0, 96, 3}, {24, 96, 2}, {48, 96, 3}}},   // On rope left
+    {3, {{0, 64, 3}, {24, 64, 2}, {48, 64, 3}}},   // On rope right
+    {1, {{72, 0, 0}}},                             // Falling
+    {2, {{72, 0, 8}, {72, 32, 8}}},                // Blinking
+};
 
-global level Level;
-global bmp_file *gImage;
-global game_sound gSound;
-global platform_sound_output *gSoundOutput;
-global i32 gScore;
-global bool32 gUpdateScore = true;
+global const animation kEnemyAnimations[PersonAnimation_Count] = {
+    {3, {{0, 192, 6}, {24, 192, 4}, {48, 192, 6}}},  // Going left
+    {3, {{0, 160, 6}, {24, 160, 4}, {48, 160, 6}}},  // Going right
+    {2, {{0, 288, 8}, {24, 288, 8}}},                // On ladder
+    {3, {{0, 256, 6}, {24, 256, 4}, {48, 256, 6}}},  // On rope left
+    {3, {{0, 224, 6}, {24, 224, 4}, {48, 224, 6}}},  // On rope right
+    {1, {{72, 160, 0}}},                             // Falling
+    {},                                              // Enemies don't blink
+};
 
-global bool32 gDebug = false;
+// In the order of brick_animation
+global const animation kBrickAnimations[BrickAnimation_Count] = {
+    {3, {{96, 32, 2}, {128, 32, 2}, {160, 32, 2}}},
+    {4, {{192, 0, 8}, {192, 32, 8}, {192, 64, 8}, {192, 96, 8}}},
+};
 
-global int kTileWidth = 32;
-global int kTileHeight = 32;
-global int kHumanWidth = 24;
-global int kHumanHeight = 32;
+// In the order of tile_type
+global const u8 kTileFlags[LVL_INVALID + 1] = {
+    // blank
+    TileFlag_Pathable,
+    // dug out brick
+    TileFlag_Supports,
+    // brick
+    TileFlag_Solid | TileFlag_Diggable | TileFlag_Supports,
+    // hard brick
+    TileFlag_Solid | TileFlag_Supports,
+    // fake brick
+    TileFlag_Supports,
+    // ladder
+    TileFlag_Climbable | TileFlag_Supports | TileFlag_Pathable,
+    // ladder that shows up at the end
+    TileFlag_Pathable,
+    // rope
+    TileFlag_Hangable | TileFlag_Supports | TileFlag_Pathable,
+    // treasure
+    TileFlag_Pathable,
+    // where a treasure was
+    TileFlag_Supports | TileFlag_Pathable,
+    // respawn
+    TileFlag_Pathable,
+    // outside the level
+    TileFlag_Supports,
+};
 
-void *GameMemoryAlloc(int SizeInBytes) {
-  void *Result = GameMemory->Free;
+global const animation kDisappearingAnimation = {
+    3, {{96, 160, 2}, {128, 160, 2}, {160, 160, 2}}};
+
+internal void InitializeArena(memory_arena *Arena, u8 *Base, int Size,
+                              platform_commit_memory *Commit, bool32 IsHot) {
+  *Arena = {};
+  Arena->Base = Base;
+  Arena->Size = Size;
+  Arena->IsHot = IsHot;
+  Arena->Commit = Commit;
+  if (Commit == NULL) {
+    Arena->Committed = Size;
+  }
+}
 
-  GameMemory->Free = (void *)((u8 *)GameMemory->Free + SizeInBytes);
-  i64 CurrentSize = ((u8 *)GameMemory->Free - (u8 *)GameMemory->Start);
-  Assert(CurrentSize < GameMemory->MemorySize);
+// Not cleared, whatever was there before is still there.
+// NULL if the arena is full or the platform can't commit the memory.
+void *PushSize(memory_arena *Arena, int SizeInBytes) {
+  // Keep everything 16 byte aligned
+  int Size = (SizeInBytes + 15) & ~15;
+  int Used = Arena->Used + Size;
+  if (Used > Arena->Size) {
+    Assert(!"The arena is full");
+    return NULL;
+  }
+
+  if (Used > Arena->Committed) {
+    int Granularity = Arena->IsHot ? kArenaAlignment : kCommitGranularity;
+    int Committed = (Used + Granularity - 1) & ~(Granularity - 1);
+    if (Committed > Arena->Size) {
+      Committed = Arena->Size;
+    }
+    if (!Arena->Commit(Arena->Base + Arena->Committed,
+                       Committed - Arena->Committed, Arena->IsHot)) {
+      Assert(!"Cannot commit arena memory");
+      return NULL;
+    }
+    Arena->Committed = Committed;
+  }
+
+  void *Result = Arena->Base + Arena->Used;
+  Arena->Used = Used;
+  if (Arena->HighWater < Arena->Used) {
+    Arena->HighWater = Arena->Used;
+  }
 
   return Result;
 }
 
-void PlaySound(loaded_sound *Sound) {
-  gSoundOutput->SamplesWritten = -1;
-  gSoundOutput->Playing = Sound;
+inline void ResetArena(memory_arena *Arena) {
+  Arena->Used = 0;
 }
 
-inline u8 UnmaskColor(u32 Pixel, u32 ColorMask) {
-  int BitOffset = 0;
-  switch (ColorMask) {
-    case 0x000000FF:
-      BitOffset = 0;
-      break;
-    case 0x0000FF00:
-      BitOffset = 8;
-      break;
-    case 0x00FF0000:
-      BitOffset = 16;
-      break;
-    case 0xFF000000:
-      BitOffset = 24;
-      break;
-  }
+void PlaySound(game_state *State, loaded_sound *Sound) {
+  State->SoundOutput->SamplesWritten = -1;
+  State->SoundOutput->Playing = Sound;
+}
 
-  return (u8)((Pixel & ColorMask) >> BitOffset);
+internal void DrawRectangle(game_state *State, v2i Position, int Width,
+                            int Height, u32 Color) {
+  PushRectangle(State->RenderGroup, Position.x, Position.y, Width, Height,
+                Color);
 }
 
-internal void DrawRectangle(v2i Position, int Width, int Height, u32 Color) {
-  int X = Position.x;
-  int Y = Position.y;
+internal void DrawRectangle(game_state *State, int X, int Y, int Width,
+                            int Height, u32 Color) {
+  v2i Position = {X, Y};
+  DrawRectangle(State, Position, Width, Height, Color);
+}
 
-  int Pitch = GameBackBuffer->Width * GameBackBuffer->BytesPerPixel;
-  u8 *Row = (u8 *)GameBackBuffer->Memory + GameBackBuffer->StartOffset +
-            Pitch * Y + X * GameBackBuffer->BytesPerPixel;
+inline void SetPixel(game_state *State, int X, int Y, u32 Color) {
+  PushRectangle(State->RenderGroup, X, Y, 1, 1, Color);
+}
 
-  for (int pY = Y; pY < Y + Height; pY++) {
-    u32 *Pixel = (u32 *)Row;
-    for (int pX = X; pX < X + Width; pX++) {
-      *Pixel++ = Color;
-    }
-    Row += Pitch;
+internal void DrawSprite(game_state *State, v2i Position, int Width,
+                         int Height, int XOffset, int YOffset) {
+  PushSprite(State->RenderGroup, Position.x, Position.y, Width, Height, XOffset,
+             YOffset);
+}
+
+// Where a tile is in State->Tiles. Anything from -1 to Width or Height
+// is fine, one step off the level lands on the border.
+inline int TileIndex(level *Level, int Col, int Row) {
+  Assert(Col >= -1 && Col <= Level->Width && Row >= -1 &&
+         Row <= Level->Height);
+  return (Row + 1) * (Level->Width + 2) + Col + 1;
+}
+
+// LVL_INVALID next to the level, see TileIndex for how far out it can go
+inline tile_type CheckTile(game_state *State, int Col, int Row) {
+  return (tile_type)State->Tiles[TileIndex(&State->Sim.Level, Col, Row)];
+}
+
+inline u32 TileFlags(game_state *State, int Col, int Row) {
+  return kTileFlags[CheckTile(State, Col, Row)];
+}
+
+inline u64 *GetTilePlane(game_state *State, tile_flag Flag) {
+  int Index = 0;
+  while ((1 << Index) != Flag) {
+    Index++;
   }
+  return State->TilePlanes[Index];
 }
 
-internal void DrawRectangle(int X, int Y, int Width, int Height, u32 Color) {
-  v2i Position = {X, Y};
-  DrawRectangle(Position, Width, Height, Color);
+// Same bounds as TileIndex
+inline bool32 CheckPlaneBit(game_state *State, u64 *Plane, int Col,
+                            int Row) {
+  int Bit = Col + 1;
+  u64 Word = Plane[(Row + 1) * State->TilePlaneStride + Bit / 64];
+  return (Word >> (Bit % 64)) & 1;
 }
 
-inline void SetPixel(int X, int Y, u32 Color) {
-  int Pitch = GameBackBuffer->Width * GameBackBuffer->BytesPerPixel;
-  u8 *Row = (u8 *)GameBackBuffer->Memory + GameBackBuffer->StartOffset +
-            Pitch * Y + X * GameBackBuffer->BytesPerPixel;
-  u32 *Pixel = (u32 *)Row;
-  *Pixel = Color;
+inline void SetPlaneBit(game_state *State, u64 *Plane, int Col, int Row,
+                        bool32 Value) {
+  int Bit = Col + 1;
+  u64 *Word = &Plane[(Row + 1) * State->TilePlaneStride + Bit / 64];
+  u64 Mask = (u64)1 << (Bit % 64);
+  *Word = Value ? (*Word | Mask) : (*Word & ~Mask);
 }
 
-internal void DrawSprite(v2i Position, int Width, int Height, int XOffset,
-                         int YOffset) {
-  // NOTE: if we need a draw image function, it's easily derived from this one
+// Changes the tile and its bits in the planes
+internal void PutTile(game_state *State, int Col, int Row, tile_type Value) {
+  State->Tiles[TileIndex(&State->Sim.Level, Col, Row)] = (u8)Value;
+  for (int i = 0; i < kTileFlagCount; i++) {
+    SetPlaneBit(State, State->TilePlanes[i], Col, Row,
+                kTileFlags[Value] & (1 << i));
+  }
+}
 
-  // If we ever need another image, we'll need a new func
-  bmp_file *Image = gImage;
+void SetTile(game_state *State, int Col, int Row, tile_type Value) {
+  level *Level = &State->Sim.Level;
+  if (Row < 0 || Row >= Level->Height || Col < 0 || Col >= Level->Width) {
+    return;  // Invalid tile
+  }
+  PutTile(State, Col, Row, Value);
+}
 
-  int X = (int)Position.x;
-  int Y = (int)Position.y;
+void DrawTile(game_state *State, int Col, int Row) {
+  level *Level = &State->Sim.Level;
+  if (Col < 0 || Row < 0 || Col >= Level->Width || Row >= Level->Height) {
+    // Don't draw outside level boundaries
+    return;
+  }
+  PushTile(State->RenderGroup, Col, Row, Col * kTileWidth, Row * kTileHeight,
+           kTileWidth, kTileHeight);
+}
 
-  int Pitch = GameBackBuffer->Width * GameBackBuffer->BytesPerPixel;
-  int SrcPitch = gImage->Width;
+// For the simulation, the tile is drawn the next time the game is rendered
+void InvalidateTile(game_state *State, int Col, int Row) {
+  level *Level = &State->Sim.Level;
+  if (Col < 0 || Row < 0 || Col >= Level->Width || Row >= Level->Height) {
+    return;
+  }
+  if (State->Redraw.View) {
+    return;  // everything is going to be redrawn anyway
+  }
+  if (State->Redraw.TileCount == MAX_DIRTY_TILE_COUNT) {
+    State->Redraw.View = true;
+    return;
+  }
+  State->Redraw.Tiles[State->Redraw.TileCount++] = {Col, Row};
+}
 
-  u8 *Row = (u8 *)GameBackBuffer->Memory + GameBackBuffer->StartOffset +
-            Pitch * Y + X * GameBackBuffer->BytesPerPixel;
-  u32 *BottomLeftCorner =
-      (u32 *)Image->Bitmap + Image->Width * (Image->Height - 1);
-  u32 *SrcRow = BottomLeftCorner - SrcPitch * YOffset + XOffset;
+// Whether the level has been drawn up to this tile yet
+inline bool32 IsTileRevealed(game_state *State, int Col, int Row) {
+  level *Level = &State->Sim.Level;
+  return Level->IsDrawn || Row * Level->Width + Col < Level->TileBeingDrawn;
+}
 
-  for (int pY = Y; pY < Y + Height; pY++) {
-    int *Pixel = (int *)Row;
-    int *SrcPixel = (int *)SrcRow;
+// Fits the view into the buffer with the footer under it and moves the
+// camera after the player. Returns true if the camera has moved.
+internal bool32 UpdateViewport(game_state *State) {
+  level *Level = &State->Sim.Level;
+  viewport *View = &Level->Viewport;
+  int LevelWidth = Level->Width * kTileWidth;
+  int LevelHeight = Level->Height * kTileHeight;
+  int FooterHeight = 2 * kTileHeight;
+
+  View->Width = LevelWidth;
+  if (View->Width > State->BackBuffer->Width) {
+    View->Width = State->BackBuffer->Width;
+  }
+  View->Height = LevelHeight;
+  if (View->Height > State->BackBuffer->Height - FooterHeight) {
+    View->Height = State->BackBuffer->Height - FooterHeight;
+  }
+  View->ScreenX = (State->BackBuffer->Width - View->Width) / 2;
+  View->ScreenY = (State->BackBuffer->Height - View->Height - FooterHeight) / 2;
 
-    for (int pX = X; pX < X + Width; pX++) {
-      u8 Red = UnmaskColor(*SrcPixel, Image->RedMask);
-      u8 Green = UnmaskColor(*SrcPixel, Image->GreenMask);
-      u8 Blue = UnmaskColor(*SrcPixel, Image->BlueMask);
-      u8 Alpha = UnmaskColor(*SrcPixel, Image->AlphaMask);
+  player *Player = &Level->Players[0];
+  int CameraX = View->CameraX;
+  int CameraY = View->CameraY;
 
-      u32 ResultingColor = Red << 16 | Green << 8 | Blue;
+  if (!View->IsInitialized) {
+    View->IsInitialized = true;
+    CameraX = Player->X - View->Width / 2;
+    CameraY = Player->Y - View->Height / 2;
+  } else {
+    // Only scroll when the player leaves the middle of the view
+    int MarginX = View->Width / 4;
+    int MarginY = View->Height / 4;
+    if (Player->X < CameraX + MarginX) {
+      CameraX = Player->X - MarginX;
+    }
+    if (Player->X > CameraX + View->Width - MarginX) {
+      CameraX = Player->X - View->Width + MarginX;
+    }
+    if (Player->Y < CameraY + MarginY) {
+      CameraY = Player->Y - MarginY;
+    }
+    if (Player->Y > CameraY + View->Height - MarginY) {
+      CameraY = Player->Y - View->Height + MarginY;
+    }
+  }
 
-      if (Alpha > 0 && Alpha < 0xFF) {
-        r32 ExistingRed = (r32)((*Pixel >> 16) & 0xFF);
-        r32 ExistingGreen = (r32)((*Pixel >> 8) & 0xFF);
-        r32 ExistingBlue = (r32)((*Pixel >> 0) & 0xFF);
+  // Don't show anything outside the level
+  if (CameraX > LevelWidth - View->Width) CameraX = LevelWidth - View->Width;
+  if (CameraY > LevelHeight - View->Height) CameraY = LevelHeight - View->Height;
+  if (CameraX < 0) CameraX = 0;
+  if (CameraY < 0) CameraY = 0;
 
-        r32 NewRed = (r32)((ResultingColor >> 16) & 0xFF);
-        r32 NewGreen = (r32)((ResultingColor >> 8) & 0xFF);
-        r32 NewBlue = (r32)((ResultingColor >> 0) & 0xFF);
+  bool32 Moved = (CameraX != View->CameraX || CameraY != View->CameraY);
+  View->CameraX = CameraX;
+  View->CameraY = CameraY;
 
-        // Blending
-        r32 t = (r32)Alpha / 255.0f;
+  return Moved;
+}
 
-        NewRed = NewRed * t + ExistingRed * (1 - t);
-        NewGreen = NewGreen * t + ExistingGreen * (1 - t);
-        NewBlue = NewBlue * t + ExistingBlue * (1 - t);
+// Columns and rows of the tiles at least partially in the view
+internal rect GetVisibleTiles(game_state *State) {
+  level *Level = &State->Sim.Level;
+  viewport *View = &Level->Viewport;
+  rect Result;
 
-        *Pixel =
-            (((u8)NewRed << 16) | ((u8)NewGreen << 8) | ((u8)NewBlue << 0));
-      } else if (Alpha == 0xFF) {
-        *Pixel = ResultingColor;
-      } else {
-        // do nothing
-      }
+  Result.Left = View->CameraX / kTileWidth;
+  Result.Top = View->CameraY / kTileHeight;
+  Result.Right = (View->CameraX + View->Width + kTileWidth - 1) / kTileWidth;
+  Result.Bottom =
+      (View->CameraY + View->Height + kTileHeight - 1) / kTileHeight;
 
-      Pixel++;
-      SrcPixel++;
-    }
-    Row += Pitch;
-    SrcRow -= SrcPitch;
-  }
+  return Result;
 }
 
-tile_type CheckTile(int Col, int Row) {
-  if (Row < 0 || Row >= Level.Height || Col < 0 || Col >= Level.Width) {
-    return LVL_INVALID;
-  }
-  return Level.Contents[Row][Col];
+// Level pixels, clipped to the view
+internal void SetWorldTransform(game_state *State) {
+  level *Level = &State->Sim.Level;
+  viewport *View = &Level->Viewport;
+  rect ViewRect = {View->ScreenY, View->ScreenY + View->Height, View->ScreenX,
+                   View->ScreenX + View->Width};
+  SetRenderTransform(State->RenderGroup, View->ScreenX - View->CameraX,
+                     View->ScreenY - View->CameraY, ViewRect);
 }
 
-void SetTile(int Col, int Row, tile_type Value) {
-  if (Row < 0 || Row >= Level.Height || Col < 0 || Col >= Level.Width) {
-    return;  // Invalid tile
-  }
-  Level.Contents[Row][Col] = Value;
+// Pixels relative to the top left corner of the view, for the interface
+internal void SetScreenTransform(game_state *State) {
+  level *Level = &State->Sim.Level;
+  viewport *View = &Level->Viewport;
+  rect BufferRect = {0, State->BackBuffer->Height, 0, State->BackBuffer->Width};
+  SetRenderTransform(State->RenderGroup, View->ScreenX, View->ScreenY,
+                     BufferRect);
 }
 
-void DrawTile(int Col, int Row) {
-  if (Col < 0 || Row < 0 || Col >= Level.Width || Row >= Level.Height) {
-    // Don't draw outside level boundaries
-    return;
-  }
-  v2i Position = {};
-  Position.x = (Col * kTileWidth);
-  Position.y = (Row * kTileHeight);
-  int Value = CheckTile(Col, Row);
+// Tiles are looked up when the frame is rendered, not when they're pushed
+internal RESOLVE_TILE(ResolveTile) {
+  game_state *State = (game_state *)Context;
+  int Value = CheckTile(State, Entry->Col, Entry->Row);
+  Entry->Type = RenderEntry_Sprite;
   if (Value == LVL_BRICK || Value == LVL_BRICK_FAKE) {
-    DrawSprite(Position, kTileWidth, kTileHeight, 160, 96);
+    Entry->XOffset = 160;
+    Entry->YOffset = 96;
   } else if (Value == LVL_BRICK_HARD) {
-    DrawSprite(Position, kTileWidth, kTileHeight, 128, 96);
+    Entry->XOffset = 128;
+    Entry->YOffset = 96;
   } else if (Value == LVL_LADDER) {
-    DrawSprite(Position, kTileWidth, kTileHeight, 96, 128);
+    Entry->XOffset = 96;
+    Entry->YOffset = 128;
   } else if (Value == LVL_ROPE) {
-    DrawSprite(Position, kTileWidth, kTileHeight, 128, 128);
+    Entry->XOffset = 128;
+    Entry->YOffset = 128;
   } else {
-    DrawRectangle(Position, kTileWidth, kTileHeight, 0x000A0D0B);
+    Entry->Type = RenderEntry_Rectangle;
+    Entry->Color = kBackgroundColor;
   }
 }
 
-void DrawText(const char *String, int X, int Y) {
-  v2i Position = {};
-  Position.x = X;
-  Position.y = Y;
-  v2i Offset = {};
+// Glyphs are laid out in the atlas in rows of 32x32 cells
+global const char *kGlyphRows[] = {
+    "abcde", "orunl", "vsify", "kpmt", "01234", "56789",
+};
+
+// Finds the box around the pixels that differ from the cell's corner.
+// The cell is opaque background everywhere else.
+internal void FindGlyphInk(bmp_file *Image, glyph *Glyph) {
+  Glyph->InkX = 0;
+  Glyph->InkY = 0;
+  Glyph->InkWidth = Glyph->Width;
+  Glyph->InkHeight = Glyph->Height;
+  if (Image == NULL) return;
 
-  while (*String != '\0') {
-    char c = *String++;
-    bool32 CharFound = true;
-
-    if (c == 'a') {
-      Offset = {96, 192};
-    } else if (c == 'b') {
-      Offset = {128, 192};
-    } else if (c == 'c') {
-      Offset = {160, 192};
-    } else if (c == 'd') {
-      Offset = {192, 192};
-    } else if (c == 'e') {
-      Offset = {224, 192};
-    } else if (c == 'o') {
-      Offset = {96, 224};
-    } else if (c == 'r') {
-      Offset = {128, 224};
-    } else if (c == 'u') {
-      Offset = {160, 224};
-    } else if (c == 'n') {
-      Offset = {192, 224};
-    } else if (c == 'l') {
-      Offset = {224, 224};
-    } else if (c == 'v') {
-      Offset = {96, 256};
-    } else if (c == 's') {
-      Offset = {128, 256};
-    } else if (c == 'i') {
-      Offset = {160, 256};
-    } else if (c == 'f') {
-      Offset = {192, 256};
-    } else if (c == 'y') {
-      Offset = {224, 256};
-    } else if (c == 'k') {
-      Offset = {96, 288};
-    } else if (c == 'p') {
-      Offset = {128, 288};
-    } else if (c == 'm') {
-      Offset = {160, 288};
-    } else if (c == 't') {
-      Offset = {192, 288};
-    } else if (c == '0') {
-      Offset = {96, 320};
-    } else if (c == '1') {
-      Offset = {128, 320};
-    } else if (c == '2') {
-      Offset = {160, 320};
-    } else if (c == '3') {
-      Offset = {192, 320};
-    } else if (c == '4') {
-      Offset = {224, 320};
-    } else if (c == '5') {
-      Offset = {96, 352};
-    } else if (c == '6') {
-      Offset = {128, 352};
-    } else if (c == '7') {
-      Offset = {160, 352};
-    } else if (c == '8') {
-      Offset = {192, 352};
-    } else if (c == '9') {
-      Offset = {224, 352};
-    } else {
-      CharFound = false;
+  u32 *BottomLeftCorner =
+      (u32 *)Image->Bitmap + Image->Width * (Image->Height - 1);
+  u32 *Cell =
+      BottomLeftCorner - Image->Width * Glyph->YOffset + Glyph->XOffset;
+  u32 Background = Cell[0];
+
+  int Left = Glyph->Width;
+  int Right = 0;
+  int Top = Glyph->Height;
+  int Bottom = 0;
+  for (int Y = 0; Y < Glyph->Height; Y++) {
+    u32 *Row = Cell - Image->Width * Y;
+    for (int X = 0; X < Glyph->Width; X++) {
+      if (Row[X] != Background) {
+        if (Left > X) Left = X;
+        if (Right < X + 1) Right = X + 1;
+        if (Top > Y) Top = Y;
+        if (Bottom < Y + 1) Bottom = Y + 1;
+      }
     }
+  }
 
-    if (CharFound) {
-      DrawSprite(Position, kTileWidth, kTileHeight, Offset.x, Offset.y);
+  if (Left < Right) {
+    Glyph->InkX = Left;
+    Glyph->InkY = Top;
+    Glyph->InkWidth = Right - Left;
+    Glyph->InkHeight = Bottom - Top;
+  } else {
+    Glyph->InkWidth = 0;
+    Glyph->InkHeight = 0;
+  }
+}
+
+internal void InitGlyphs(game_state *State) {
+  int FirstX = 96;
+  int FirstY = 192;
+
+  for (int Row = 0; Row < (int)COUNT_OF(kGlyphRows); Row++) {
+    for (int Col = 0; kGlyphRows[Row][Col] != '\0'; Col++) {
+      glyph *Glyph = &State->Glyphs[(int)kGlyphRows[Row][Col]];
+      Glyph->Exists = true;
+      Glyph->XOffset = FirstX + Col * kTileWidth;
+      Glyph->YOffset = FirstY + Row * kTileHeight;
+      Glyph->Width = kTileWidth;
+      Glyph->Height = kTileHeight;
+      FindGlyphInk(State->Image, Glyph);
     }
+  }
 
-    Position.x += kTileWidth;
+  // Unknown characters are spaces
+  for (int i = 0; i < (int)COUNT_OF(State->Glyphs); i++) {
+    State->Glyphs[i].Advance = kTileWidth;
   }
+
+  State->GlyphsInitialized = true;
 }
 
-internal void DrawNumber(int Number, int TileX, int TileY) {
+inline glyph *GetGlyph(game_state *State, char c) {
+  glyph *Result = &State->Glyphs[(u8)c & 0x7F];
+  return Result;
+}
+
+inline void DrawGlyph(game_state *State, glyph *Glyph, int X, int Y) {
+  if (Glyph->Exists) {
+    DrawSprite(State, {X, Y}, Glyph->Width, Glyph->Height, Glyph->XOffset,
+               Glyph->YOffset);
+  }
+}
+
+void DrawText(game_state *State, const char *String, int X, int Y) {
+  if (!State->GlyphsInitialized) {
+    InitGlyphs(State);
+  }
+
+  while (*String != '\0') {
+    glyph *Glyph = GetGlyph(State, *String++);
+    DrawGlyph(State, Glyph, X, Y);
+    X += Glyph->Advance;
+  }
+}
+
+// Draws New where Old used to be, only as much of it as covers the ink
+// of both. Relies on the glyph cells being opaque: the background of New
+// is what erases Old.
+internal void ReplaceGlyph(game_state *State, glyph *Old, glyph *New, int X,
+                           int Y) {
+  rect Box = {};
+  if (Old->Exists) {
+    rect OldInk = {Old->InkY, Old->InkY + Old->InkHeight, Old->InkX,
+                   Old->InkX + Old->InkWidth};
+    Box = OldInk;
+  }
+  if (New->Exists) {
+    rect NewInk = {New->InkY, New->InkY + New->InkHeight, New->InkX,
+                   New->InkX + New->InkWidth};
+    Box = UnionRects(Box, NewInk);
+  }
+  if (RectIsEmpty(Box)) return;
+
+  // Whole native pixels only, or the atlas and the screen would disagree
+  int Scale = State->RenderGroup->Scale;
+  Box.Top -= Box.Top % Scale;
+  Box.Left -= Box.Left % Scale;
+  Box.Bottom += (Scale - Box.Bottom % Scale) % Scale;
+  Box.Right += (Scale - Box.Right % Scale) % Scale;
+
+  int Width = Box.Right - Box.Left;
+  int Height = Box.Bottom - Box.Top;
+  if (New->Exists) {
+    DrawSprite(State, {X + Box.Left, Y + Box.Top}, Width, Height,
+               New->XOffset + Box.Left, New->YOffset + Box.Top);
+  } else {
+    DrawRectangle(State, X + Box.Left, Y + Box.Top, Width, Height,
+                  kBackgroundColor);
+  }
+}
+
+// Only draws what's different from the last time the run was drawn,
+// see ReplaceGlyph.
+internal void DrawTextRun(game_state *State, text_run *Run, const char *String,
+                          int X, int Y) {
+  if (!State->GlyphsInitialized) {
+    InitGlyphs(State);
+  }
+
+  if (Run->IsValid && (Run->X != X || Run->Y != Y ||
+                       strlen(Run->Text) != strlen(String))) {
+    Run->IsValid = false;
+  }
+  Run->X = X;
+  Run->Y = Y;
+
+  int i = 0;
+  for (; String[i] != '\0' && i < MAX_TEXT_RUN_LENGTH - 1; i++) {
+    char c = String[i];
+    glyph *Glyph = GetGlyph(State, c);
+    if (!Run->IsValid) {
+      DrawGlyph(State, Glyph, X, Y);
+    } else if (Run->Text[i] != c) {
+      ReplaceGlyph(State, GetGlyph(State, Run->Text[i]), Glyph, X, Y);
+    }
+    Run->Text[i] = c;
+    X += Glyph->Advance;
+  }
+  Run->Text[i] = '\0';
+  Run->IsValid = true;
+}
+
+internal void DrawNumber(game_state *State, int Number, int TileX, int TileY) {
   // Only 2 digit numbers are supported
   int Digit1 = Number % 10;
   int Digit2 = (Number / 10) % 10;
@@ -278,13 +527,13 @@ internal void DrawNumber(int Number, int TileX, int TileY) {
   String[2] = 0;
   String[1] = (char)('0' + Digit1);
   String[0] = (char)('0' + Digit2);
-  DrawText(String, TileX * kTileWidth, TileY * kTileHeight);
+  DrawText(State, String, TileX * kTileWidth, TileY * kTileHeight);
 }
 
-internal bmp_file DEBUGReadBMPFile(char const *Filename) {
+internal bmp_file DEBUGReadBMPFile(game_memory *Memory, char const *Filename) {
   bmp_file Result = {};
   file_read_result FileReadResult =
-      GameMemory->DEBUGPlatformReadEntireFile(Filename);
+      Memory->DEBUGPlatformReadEntireFile(Filename);
 
   Assert(FileReadResult.MemorySize > 0);
 
@@ -356,11 +605,11 @@ inline u32 GetChunkType(riff_iterator Iter) {
   return Result;
 }
 
-internal loaded_sound ReadWAVFile(char const *Filename) {
+internal loaded_sound ReadWAVFile(game_memory *Memory, char const *Filename) {
   loaded_sound Result = {};
 
   file_read_result FileReadResult =
-      GameMemory->DEBUGPlatformReadEntireFile(Filename);
+      Memory->DEBUGPlatformReadEntireFile(Filename);
 
   Assert(FileReadResult.MemorySize > 0);
 
@@ -401,41 +650,112 @@ internal loaded_sound ReadWAVFile(char const *Filename) {
   return Result;
 }
 
-internal bmp_file *LoadSprite(char const *Filename) {
-  bmp_file *Result = (bmp_file *)GameMemoryAlloc(sizeof(bmp_file));
-  *Result = DEBUGReadBMPFile(Filename);
+internal bmp_file *LoadSprite(game_memory *Memory, memory_arena *Arena,
+                              char const *Filename) {
+  bmp_file *Result = PushStruct(Arena, bmp_file);
+  *Result = DEBUGReadBMPFile(Memory, Filename);
 
   return Result;
 }
 
-void LoadLevel(int Index) {
-  // Zero everything
-  Level = {};
-  Level.IsInitialized = true;
-  Level.Index = Index;
-  Level.IsDrawn = false;
-  Level.TileBeingDrawn = 0;
-  gUpdateScore = true;
-  gClock = true;
-
-  // Init disappearing animation
-  {
-    animation *Animation = &Level.Disappearing;
-    Animation->FrameCount = 3;
-    Animation->Frames[0] = {96, 160, 2};
-    Animation->Frames[1] = {128, 160, 2};
-    Animation->Frames[2] = {160, 160, 2};
+inline int GetBorderedTileCount(level *Level) {
+  return (Level->Width + 2) * (Level->Height + 2);
+}
+
+// Frees whatever the last level had and makes room for the current one's.
+// The tiles are all LVL_BLANK but the border, the planes are left to
+// UpdateTilePlanes. False if the level doesn't fit.
+internal bool32 SetUpLevelArena(game_state *State) {
+  level *Level = &State->Sim.Level;
+  memory_arena *Arena = &State->Arenas[GameArena_Level];
+  ResetArena(Arena);
+  if (GetLevelArenaSize(Level->Width, Level->Height) > Arena->Size) {
+    return false;
+  }
+
+  int TileCount = Level->Width * Level->Height;
+  int BorderedCount = GetBorderedTileCount(Level);
+  // UpdateTilePlanes reads up to 15 bytes past the last tile
+  State->Tiles = PushArray(Arena, BorderedCount + 15, u8);
+  if (State->Tiles == NULL) return false;
+  memset(State->Tiles, LVL_BLANK, BorderedCount);
+  for (int Col = -1; Col <= Level->Width; Col++) {
+    State->Tiles[TileIndex(Level, Col, -1)] = LVL_INVALID;
+    State->Tiles[TileIndex(Level, Col, Level->Height)] = LVL_INVALID;
+  }
+  for (int Row = 0; Row < Level->Height; Row++) {
+    State->Tiles[TileIndex(Level, -1, Row)] = LVL_INVALID;
+    State->Tiles[TileIndex(Level, Level->Width, Row)] = LVL_INVALID;
+  }
+
+  State->WaterMap = PushArray(Arena, BorderedCount, water_point);
+  State->DirectionMap = PushArray(Arena, TileCount, int);
+  if (State->WaterMap == NULL || State->DirectionMap == NULL) return false;
+
+  State->TilePlaneStride = (Level->Width + 2 + 63) / 64;
+  int PlaneSize = State->TilePlaneStride * (Level->Height + 2);
+  State->SidewaysPlane = PushArray(Arena, PlaneSize, u64);
+  if (State->SidewaysPlane == NULL) return false;
+  memset(State->SidewaysPlane, 0, PlaneSize * sizeof(u64));
+  for (int i = 0; i < kTileFlagCount; i++) {
+    State->TilePlanes[i] = PushArray(Arena, PlaneSize, u64);
+    if (State->TilePlanes[i] == NULL) return false;
+  }
+
+  return true;
+}
+
+// Builds the planes from the tiles all over again. Loading a state does
+// this, so it goes 16 tiles at a time: one bit mask per tile_type, then
+// the flags of the types that are there.
+internal void UpdateTilePlanes(game_state *State) {
+  level *Level = &State->Sim.Level;
+  int RowLength = Level->Width + 2;
+  for (int Row = 0; Row < Level->Height + 2; Row++) {
+    u8 *Tiles = State->Tiles + Row * RowLength;
+    for (int Word = 0; Word < State->TilePlaneStride; Word++) {
+      int First = Word * 64;
+      u64 TypeBits[LVL_INVALID + 1] = {};
+      for (int Col = First; Col < First + 64 && Col < RowLength; Col += 16) {
+        __m128i Types = _mm_loadu_si128((__m128i *)(Tiles + Col));
+        for (int Type = 0; Type <= LVL_INVALID; Type++) {
+          __m128i IsType = _mm_cmpeq_epi8(Types, _mm_set1_epi8((char)Type));
+          TypeBits[Type] |= (u64)(u32)_mm_movemask_epi8(IsType)
+                            << (Col - First);
+        }
+      }
+
+      // What's read past the end of the row isn't part of it
+      u64 RowMask = ~(u64)0;
+      if (RowLength - First < 64) {
+        RowMask = ((u64)1 << (RowLength - First)) - 1;
+      }
+      for (int i = 0; i < kTileFlagCount; i++) {
+        u64 Bits = 0;
+        for (int Type = 0; Type <= LVL_INVALID; Type++) {
+          if (kTileFlags[Type] & (1 << i)) {
+            Bits |= TypeBits[Type];
+          }
+        }
+        State->TilePlanes[i][Row * State->TilePlaneStride + Word] =
+            Bits & RowMask;
+      }
+    }
   }
+}
 
-  const char *LevelString = LEVELS[Index];
+// Sizes the level and counts what's in it, as much of it as fits
+internal void MeasureLevel(level *Level, char const *LevelString) {
+  Level->PlayerCount = 0;
+  Level->EnemyCount = 0;
+  Level->TreasureCount = 0;
 
-  // Get level info
   int MaxWidth = 0;
   int Width = 0;
   int Height = 1;
 
   int i = 0;
-  char Symbol = LevelString[0];
+  char Symbol;
 
   while ((Symbol = LevelString[i++]) != '\0') {
     if (Symbol == '\n') {
@@ -448,43 +768,86 @@ void LoadLevel(int Index) {
       Width += 1;
     }
     if (Symbol == 'p') {
-      Level.PlayerCount++;
+      Level->PlayerCount++;
     }
     if (Symbol == 'e' || Symbol == 'E') {
-      Level.EnemyCount++;
+      Level->EnemyCount++;
     }
     if (Symbol == 't') {
-      Level.TreasureCount++;
+      Level->TreasureCount++;
     }
   }
 
-  Level.Width = MaxWidth;
-  Level.DrawTilesPerFrame = Level.Width / 4;
-  Level.Height = Height;
+  if (MaxWidth < Width) {
+    MaxWidth = Width;  // the last line
+  }
 
-  // Allocate memory for enemies and treasures
-  Level.Enemies = (enemy *)GameMemoryAlloc(sizeof(enemy) * Level.EnemyCount);
-  Level.Treasures =
-      (treasure *)GameMemoryAlloc(sizeof(treasure) * Level.TreasureCount);
+  Level->Width = MaxWidth;
+  Level->DrawTilesPerFrame = Level->Width / 4;
+  Level->Height = Height;
+
+  // Whatever doesn't fit is left out, the rest of the level still works
+  if (Level->PlayerCount > kMaxPlayerCount) {
+    Level->PlayerCount = kMaxPlayerCount;
+  }
+  if (Level->EnemyCount > kMaxEnemyCount) {
+    Level->EnemyCount = kMaxEnemyCount;
+  }
+  if (Level->TreasureCount > kMaxTreasureCount) {
+    Level->TreasureCount = kMaxTreasureCount;
+  }
+}
+
+void LoadLevel(game_state *State, int Index) {
+  level *Level = &State->Sim.Level;
+  // Zero everything
+  *Level = {};
+  Level->IsInitialized = true;
+  Level->Index = Index;
+  Level->Random =
+      RandomSeed(State->Memory->RandomSeed, (u64)State->Sim.LevelLoadCount++);
+  Level->IsDrawn = false;
+  Level->TileBeingDrawn = 0;
+  State->UpdateScore = true;
+  State->Sim.Clock = true;
+  State->Redraw.Screen = true;
+
+  // Everything's LVL_BLANK, but the border
+  const char *LevelString = State->Memory->LevelText;
+  if (LevelString != NULL) {
+    MeasureLevel(Level, LevelString);
+    if (!SetUpLevelArena(State)) {
+      LevelString = NULL;  // too big for this game memory
+    }
+  }
+  if (LevelString == NULL) {
+    // The built-in ones always fit
+    LevelString = LEVELS[Index];
+    MeasureLevel(Level, LevelString);
+    if (!SetUpLevelArena(State)) {
+      InvalidCodePath;
+    }
+  }
 
   // Read level data
   {
     int Column = 0;
     int Row = 0;
+    int PlayerNum = 0;
     int EnemyNum = 0;
     int TreasureNum = 0;
 
-    i = 0;
-    Symbol = LevelString[0];
+    int i = 0;
+    char Symbol;
 
     while ((Symbol = LevelString[i++]) != '\0') {
       tile_type Value = LVL_BLANK;
 
       if (Symbol == '|')
         Value = LVL_WIN_LADDER;
-      else if (Symbol == 't') {
+      else if (Symbol == 't' && TreasureNum < Level->TreasureCount) {
         Value = LVL_BLANK;
-        treasure *Treasure = &Level.Treasures[TreasureNum];
+        treasure *Treasure = &Level->Treasures[TreasureNum];
         TreasureNum++;
         *Treasure = {};  // zero everything
         Treasure->TileX = Column;
@@ -495,8 +858,10 @@ void LoadLevel(int Index) {
         Treasure->Y = Treasure->TileY * kTileHeight;
       } else if (Symbol == 'r') {
         Value = LVL_RESPAWN;
-        Level.Respawns[Level.RespawnCount] = {Column, Row};
-        Level.RespawnCount++;
+        if (Level->RespawnCount < kMaxRespawnCount) {
+          Level->Respawns[Level->RespawnCount] = {Column, Row};
+          Level->RespawnCount++;
+        }
       } else if (Symbol == '=')
         Value = LVL_BRICK;
       else if (Symbol == '+')
@@ -511,21 +876,19 @@ void LoadLevel(int Index) {
         Value = LVL_LADDER;
       else if (Symbol == '-')
         Value = LVL_ROPE;
-      else if (Symbol == 'e' || Symbol == 'E') {
-        Value = Symbol == 'e' ? LVL_BLANK : LVL_WIN_LADDER;
-        enemy *Enemy = &Level.Enemies[EnemyNum];
+      else if (Symbol == 'E')
+        Value = LVL_WIN_LADDER;
+      if ((Symbol == 'e' || Symbol == 'E') && EnemyNum < Level->EnemyCount) {
+        enemy *Enemy = &Level->Enemies[EnemyNum];
+        Level->EnemyPaths[EnemyNum] = {};
         EnemyNum++;
         *Enemy = {};  // zero everything
         Enemy->TileX = Column;
         Enemy->TileY = Row;
         Enemy->X = Enemy->TileX * kTileWidth + kTileWidth / 2;
         Enemy->Y = Enemy->TileY * kTileHeight + kTileHeight / 2;
-      } else if (Symbol == 'p') {
-        Value = LVL_BLANK;
-        player *Player = &Level.Players[0];
-        if (Player->IsActive) {
-          Player = &Level.Players[1];
-        }
+      } else if (Symbol == 'p' && PlayerNum < Level->PlayerCount) {
+        player *Player = &Level->Players[PlayerNum++];
         *Player = {};  // zero everything
         Player->IsActive = true;
         Player->TileX = Column;
@@ -538,17 +901,29 @@ void LoadLevel(int Index) {
         Column = 0;
         ++Row;
       } else if (Symbol != '\r') {
-        Assert(Column < Level.Width);
-        Assert(Row < Level.Height);
-        Level.Contents[Row][Column] = Value;
+        Assert(Column < Level->Width);
+        Assert(Row < Level->Height);
+        State->Tiles[TileIndex(Level, Column, Row)] = (u8)Value;
         ++Column;
       }
     }
   }
 
+  // Dead enemies come back at a respawn, or where the enemies started
+  // if the level has none
+  if (Level->RespawnCount == 0) {
+    for (int enemy_num = 0;
+         enemy_num < Level->EnemyCount && enemy_num < kMaxRespawnCount;
+         enemy_num++) {
+      enemy *Enemy = &Level->Enemies[enemy_num];
+      Level->Respawns[enemy_num] = {Enemy->TileX, Enemy->TileY};
+      Level->RespawnCount++;
+    }
+  }
+
   // Init players
   for (int player_num = 0; player_num < 2; player_num++) {
-    player *Player = &Level.Players[player_num];
+    player *Player = &Level->Players[player_num];
     if (Player->IsInitialized) {
       continue;
     }
@@ -556,63 +931,14 @@ void LoadLevel(int Index) {
     Player->IsInitialized = true;
     Player->Width = kHumanWidth;
     Player->Height = kHumanHeight;
-    Player->Animation = &Player->Blinking;
+    Player->Animation = PersonAnimation_Blinking;
     Player->Animate = true;
     Player->Facing = RIGHT;
-
-    // Init animations
-    frame *Frames = NULL;
-    animation *Animation = NULL;
-
-    // Falling
-    Animation = &Player->Falling;
-    Animation->FrameCount = 1;
-    Animation->Frames[0] = {72, 0, 0};
-
-    // Blinking
-    Animation = &Player->Blinking;
-    Animation->FrameCount = 2;
-    Animation->Frames[0] = {72, 0, 8};
-    Animation->Frames[1] = {72, 32, 8};
-
-    // Going right
-    Animation = &Player->GoingRight;
-    Animation->FrameCount = 3;
-    Animation->Frames[0] = {0, 0, 3};
-    Animation->Frames[1] = {24, 0, 2};
-    Animation->Frames[2] = {48, 0, 3};
-
-    // Going left
-    Animation = &Player->GoingLeft;
-    Animation->FrameCount = 3;
-    Animation->Frames[0] = {0, 32, 3};
-    Animation->Frames[1] = {24, 32, 2};
-    Animation->Frames[2] = {48, 32, 3};
-
-    // On rope right
-    Animation = &Player->RopeRight;
-    Animation->FrameCount = 3;
-    Animation->Frames[0] = {0, 64, 3};
-    Animation->Frames[1] = {24, 64, 2};
-    Animation->Frames[2] = {48, 64, 3};
-
-    // On rope left
-    Animation = &Player->RopeLeft;
-    Animation->FrameCount = 3;
-    Animation->Frames[0] = {0, 96, 3};
-    Animation->Frames[1] = {24, 96, 2};
-    Animation->Frames[2] = {48, 96, 3};
-
-    // On ladder
-    Animation = &Player->Climbing;
-    Animation->FrameCount = 2;
-    Animation->Frames[0] = {0, 128, 4};
-    Animation->Frames[1] = {24, 128, 4};
   }
 
   // Init enemies
-  for (int enemy_num = 0; enemy_num < Level.EnemyCount; enemy_num++) {
-    enemy *Enemy = &Level.Enemies[enemy_num];
+  for (int enemy_num = 0; enemy_num < Level->EnemyCount; enemy_num++) {
+    enemy *Enemy = &Level->Enemies[enemy_num];
     if (Enemy->IsInitialized) {
       continue;
     }
@@ -621,61 +947,16 @@ void LoadLevel(int Index) {
 
     Enemy->Width = kHumanWidth;
     Enemy->Height = kHumanHeight;
-    Enemy->Animation = &Enemy->Falling;
+    Enemy->Animation = PersonAnimation_Falling;
     Enemy->CarriesTreasure = -1;
-
-    // Init animations
-    animation *Animation = NULL;
-
-    // Falling
-    Animation = &Enemy->Falling;
-    Animation->FrameCount = 1;
-    Animation->Frames[0] = {72, 160, 0};
-
-    // Going right
-    Animation = &Enemy->GoingRight;
-    Animation->FrameCount = 3;
-    Animation->Frames[0] = {0, 160, 6};
-    Animation->Frames[1] = {24, 160, 4};
-    Animation->Frames[2] = {48, 160, 6};
-
-    // Going left
-    Animation = &Enemy->GoingLeft;
-    Animation->FrameCount = 3;
-    Animation->Frames[0] = {0, 192, 6};
-    Animation->Frames[1] = {24, 192, 4};
-    Animation->Frames[2] = {48, 192, 6};
-
-    // On rope right
-    Animation = &Enemy->RopeRight;
-    Animation->FrameCount = 3;
-    Animation->Frames[0] = {0, 224, 6};
-    Animation->Frames[1] = {24, 224, 4};
-    Animation->Frames[2] = {48, 224, 6};
-
-    // On rope left
-    Animation = &Enemy->RopeLeft;
-    Animation->FrameCount = 3;
-    Animation->Frames[0] = {0, 256, 6};
-    Animation->Frames[1] = {24, 256, 4};
-    Animation->Frames[2] = {48, 256, 6};
-
-    // On ladder
-    Animation = &Enemy->Climbing;
-    Animation->FrameCount = 2;
-    Animation->Frames[0] = {0, 288, 8};
-    Animation->Frames[1] = {24, 288, 8};
-  }
-}
-
-internal bool32 CanGoThroughTile(int TileX, int TileY) {
-  tile_type Tile = CheckTile(TileX, TileY);
-  if (Tile == LVL_BRICK || Tile == LVL_BRICK_HARD || Tile == LVL_BLANK_TMP ||
-      Tile == LVL_INVALID || Tile == LVL_BRICK_FAKE) {
-    return false;
-  } else {
-    return true;
+    Enemy->Pursuing = -1;
   }
+
+  UpdateTilePlanes(State);
+}
+
+inline bool32 CanGoThroughTile(game_state *State, int TileX, int TileY) {
+  return TileFlags(State, TileX, TileY) & TileFlag_Pathable;
 }
 
 rect GetBoundingRect(entity *Entity) {
@@ -734,7 +1015,8 @@ bool32 EntitiesCollide(entity *Entity1, entity *Entity2, int XAdjust,
   return RectsCollide(Rect1, Rect2);
 }
 
-bool32 AcceptableMove(person *Person, bool32 IsEnemy) {
+bool32 AcceptableMove(game_state *State, person *Person, bool32 IsEnemy) {
+  level *Level = &State->Sim.Level;
   // Tells whether the player can be legitimately
   // placed in its position
 
@@ -742,21 +1024,20 @@ bool32 AcceptableMove(person *Person, bool32 IsEnemy) {
 
   // Don't go away from the level
   if (PersonRect.Left < 0 || PersonRect.Top < 0 ||
-      PersonRect.Right > Level.Width * kTileWidth ||
-      PersonRect.Bottom > Level.Height * kTileHeight)
+      PersonRect.Right > Level->Width * kTileWidth ||
+      PersonRect.Bottom > Level->Height * kTileHeight)
     return false;
 
   int TileX = ((int)Person->X + Person->Width / 2) / kTileWidth;
   int TileY = ((int)Person->Y + Person->Width / 2) / kTileHeight;
   int StartCol = (TileX <= 0) ? 0 : TileX - 1;
-  int EndCol = (TileX >= Level.Width - 1) ? TileX : TileX + 1;
+  int EndCol = (TileX >= Level->Width - 1) ? TileX : TileX + 1;
   int StartRow = (TileY <= 0) ? 0 : TileY - 1;
-  int EndRow = (TileY >= Level.Height - 1) ? TileY : TileY + 1;
+  int EndRow = (TileY >= Level->Height - 1) ? TileY : TileY + 1;
 
   for (int Row = StartRow; Row <= EndRow; Row++) {
     for (int Col = StartCol; Col <= EndCol; Col++) {
-      int Tile = CheckTile(Col, Row);
-      if (Tile != LVL_BRICK && Tile != LVL_BRICK_HARD) continue;
+      if (!(TileFlags(State, Col, Row) & TileFlag_Solid)) continue;
 
       // Collision check
       rect TileRect = GetTileRect(Col, Row);
@@ -768,8 +1049,8 @@ bool32 AcceptableMove(person *Person, bool32 IsEnemy) {
   }
 
   // Collisions with enemies
-  for (int i = 0; i < Level.EnemyCount; i++) {
-    enemy *Enemy = &Level.Enemies[i];
+  for (int i = 0; i < Level->EnemyCount; i++) {
+    enemy *Enemy = &Level->Enemies[i];
     if (Enemy == (enemy *)Person) continue;
     if (EntitiesCollide(Enemy, Person)) {
       return false;
@@ -778,7 +1059,7 @@ bool32 AcceptableMove(person *Person, bool32 IsEnemy) {
 
   if (IsEnemy) {
     // Do not fall through player-made pits
-    if (CheckTile(Person->TileX, Person->TileY) == LVL_BLANK_TMP &&
+    if (CheckTile(State, Person->TileX, Person->TileY) == LVL_BLANK_TMP &&
         PersonRect.Bottom > (Person->TileY + 1) * kTileWidth) {
       return false;
     }
@@ -787,57 +1068,74 @@ bool32 AcceptableMove(person *Person, bool32 IsEnemy) {
   return true;
 }
 
-inline void SetWMapPoint(int Col, int Row, water_point Point) {
-  if (Row < 0 || Row >= Level.Height || Col < 0 || Col >= Level.Width) {
-    Assert(0);
-    return;
-  }
-  Level.WaterMap[Row][Col] = Point;
+inline void SetWMapPoint(game_state *State, int Col, int Row,
+                         water_point Point) {
+  level *Level = &State->Sim.Level;
+  Assert(Row >= 0 && Row < Level->Height && Col >= 0 && Col < Level->Width);
+  State->WaterMap[TileIndex(Level, Col, Row)] = Point;
 }
 
-inline water_point CheckWMapPoint(int Col, int Row) {
-  if (Row < 0 || Row >= Level.Height || Col < 0 || Col >= Level.Width) {
-    return WATERMAP_OBSTACLE;
-  }
-  return Level.WaterMap[Row][Col];
+// The border around the level is all obstacles
+inline water_point CheckWMapPoint(game_state *State, int Col, int Row) {
+  level *Level = &State->Sim.Level;
+  return State->WaterMap[TileIndex(Level, Col, Row)];
 }
 
-inline void SetDMapPoint(int Col, int Row, int X, int Y) {
-  if (Row < 0 || Row >= Level.Height || Col < 0 || Col >= Level.Width) {
+inline void SetDMapPoint(game_state *State, int Col, int Row, int X, int Y) {
+  level *Level = &State->Sim.Level;
+  if (Row < 0 || Row >= Level->Height || Col < 0 || Col >= Level->Width) {
     Assert(0);
     return;
   }
-  int Value = Y * Level.Width + X;
-  Level.DirectionMap[Row][Col] = Value;
+  int Value = Y * Level->Width + X;
+  State->DirectionMap[Row * Level->Width + Col] = Value;
 }
 
 #define DM_TARGET -1
 #define FRONTIER_MAX_SIZE 500
 
-void FindPath(enemy *Enemy, player *Player) {
+void FindPath(game_state *State, enemy *Enemy, enemy_path *Path,
+              player *Player) {
+  level *Level = &State->Sim.Level;
+  int TileCount = Level->Width * Level->Height;
   // NOTE: -1 works with memset, but -2 would not
-  memset(Level.DirectionMap, -1, sizeof(Level.DirectionMap));
-  memset(Level.WaterMap, 0, sizeof(Level.WaterMap));
-
-  Level.DirectionMap[Player->TileY][Player->TileX] = DM_TARGET;
+  memset(State->DirectionMap, -1, TileCount * sizeof(int));
+
+  State->DirectionMap[Player->TileY * Level->Width + Player->TileX] =
+      DM_TARGET;
+
+  // Where the enemy could step left or right to: through a tile which
+  // has something to stand on below, or onto a rope
+  u64 *Pathable = GetTilePlane(State, TileFlag_Pathable);
+  u64 *Climbable = GetTilePlane(State, TileFlag_Climbable);
+  u64 *Hangable = GetTilePlane(State, TileFlag_Hangable);
+  int Stride = State->TilePlaneStride;
+  for (int Row = 0; Row < Level->Height; Row++) {
+    for (int i = (Row + 1) * Stride; i < (Row + 2) * Stride; i++) {
+      State->SidewaysPlane[i] =
+          (Pathable[i] & (~Pathable[i + Stride] | Climbable[i + Stride])) |
+          Hangable[i];
+    }
+  }
 
-  // Pre-fill watermap with obstacles
-  for (int Row = 0; Row < Level.Height; Row++) {
-    for (int Col = 0; Col < Level.Width; Col++) {
-      if (!CanGoThroughTile(Col, Row) &&
-          !(Col == Enemy->TileX && Row == Enemy->TileY)) {
-        SetWMapPoint(Col, Row, WATERMAP_OBSTACLE);
-      }
+  // Pre-fill watermap with obstacles, the border is LVL_INVALID so
+  // it becomes one too
+  for (int Row = -1; Row <= Level->Height; Row++) {
+    for (int Col = -1; Col <= Level->Width; Col++) {
+      bool32 IsObstacle = !CanGoThroughTile(State, Col, Row) &&
+                          !(Col == Enemy->TileX && Row == Enemy->TileY);
+      State->WaterMap[TileIndex(Level, Col, Row)] =
+          IsObstacle ? WATERMAP_OBSTACLE : WATERMAP_NOT_VISITED;
     }
   }
-  Level.WaterMap[Player->TileY][Player->TileX] = WATERMAP_WATER;
+  SetWMapPoint(State, Player->TileX, Player->TileY, WATERMAP_WATER);
 
   bool32 NewPathFound = false;
   int Iteration = 0;
   while (Iteration++ < MAX_PATH_LENGTH) {
-    for (int Row = 0; Row < Level.Height; Row++) {
-      for (int Col = 0; Col < Level.Width; Col++) {
-        if (CheckWMapPoint(Col, Row) != WATERMAP_WATER) continue;
+    for (int Row = 0; Row < Level->Height; Row++) {
+      for (int Col = 0; Col < Level->Width; Col++) {
+        if (CheckWMapPoint(State, Col, Row) != WATERMAP_WATER) continue;
 
         int X = Col;
         int Y = Row;
@@ -850,58 +1148,50 @@ void FindPath(enemy *Enemy, player *Player) {
         // Point above
         X = Col;
         Y = Row - 1;
-        if (CheckWMapPoint(X, Y) == WATERMAP_NOT_VISITED) {
-          if (CanGoThroughTile(X, Y) && CheckTile(X, Y) != LVL_BLANK_TMP) {
-            SetWMapPoint(X, Y, WATERMAP_WATER);
-            SetDMapPoint(X, Y, Col, Row);
+        if (CheckWMapPoint(State, X, Y) == WATERMAP_NOT_VISITED) {
+          if (CheckPlaneBit(State, Pathable, X, Y)) {
+            SetWMapPoint(State, X, Y, WATERMAP_WATER);
+            SetDMapPoint(State, X, Y, Col, Row);
           }
         }
 
         // Point below
         X = Col;
         Y = Row + 1;
-        if (CheckWMapPoint(X, Y) == WATERMAP_NOT_VISITED) {
-          if (CheckTile(X, Y) == LVL_LADDER ||
+        if (CheckWMapPoint(State, X, Y) == WATERMAP_NOT_VISITED) {
+          if (CheckPlaneBit(State, Climbable, X, Y) ||
               Enemy->ParalyseImmunityCooldown > 0 &&
-                  CheckTile(X, Y) == LVL_BLANK_TMP) {
-            SetWMapPoint(X, Y, WATERMAP_WATER);
-            SetDMapPoint(X, Y, Col, Row);
+                  CheckTile(State, X, Y) == LVL_BLANK_TMP) {
+            SetWMapPoint(State, X, Y, WATERMAP_WATER);
+            SetDMapPoint(State, X, Y, Col, Row);
           }
         }
 
         // Point on the left
         X = Col - 1;
         Y = Row;
-        if (CheckWMapPoint(X, Y) == WATERMAP_NOT_VISITED) {
-          if ((CanGoThroughTile(X, Y) &&
-               (!CanGoThroughTile(X, Y + 1) ||
-                CheckTile(X, Y + 1) == LVL_LADDER ||
-                CheckTile(X, Y + 1) == LVL_BLANK_TMP)) ||
-              CheckTile(X, Y) == LVL_ROPE) {
-            SetWMapPoint(X, Y, WATERMAP_WATER);
-            SetDMapPoint(X, Y, Col, Row);
+        if (CheckWMapPoint(State, X, Y) == WATERMAP_NOT_VISITED) {
+          if (CheckPlaneBit(State, State->SidewaysPlane, X, Y)) {
+            SetWMapPoint(State, X, Y, WATERMAP_WATER);
+            SetDMapPoint(State, X, Y, Col, Row);
           }
         }
 
         // Point on the right
         X = Col + 1;
         Y = Row;
-        if (CheckWMapPoint(X, Y) == WATERMAP_NOT_VISITED) {
-          if ((CanGoThroughTile(X, Y) &&
-               (!CanGoThroughTile(X, Y + 1) ||
-                CheckTile(X, Y + 1) == LVL_LADDER ||
-                CheckTile(X, Y + 1) == LVL_BLANK_TMP)) ||
-              CheckTile(X, Y) == LVL_ROPE) {
-            SetWMapPoint(X, Y, WATERMAP_WATER);
-            SetDMapPoint(X, Y, Col, Row);
+        if (CheckWMapPoint(State, X, Y) == WATERMAP_NOT_VISITED) {
+          if (CheckPlaneBit(State, State->SidewaysPlane, X, Y)) {
+            SetWMapPoint(State, X, Y, WATERMAP_WATER);
+            SetDMapPoint(State, X, Y, Col, Row);
           }
         }
       }
     }
 
     if (NewPathFound) {
-      Enemy->PathExists = true;
-      Enemy->PathPointIndex = 0;
+      Path->Exists = true;
+      Path->PointIndex = 0;
       break;
     }
   }
@@ -911,45 +1201,70 @@ void FindPath(enemy *Enemy, player *Player) {
     int X = Enemy->TileX;
     int Y = Enemy->TileY;
     for (int i = 0; i < MAX_PATH_LENGTH; i++) {
-      int NextStep = Level.DirectionMap[Y][X];
-      X = NextStep % Level.Width;
-      Y = NextStep / Level.Width;
-      Enemy->Path[i].x = X;
-      Enemy->Path[i].y = Y;
+      int NextStep = State->DirectionMap[Y * Level->Width + X];
+      X = NextStep % Level->Width;
+      Y = NextStep / Level->Width;
+      Path->Points[i].x = X;
+      Path->Points[i].y = Y;
       if (X == Player->TileX && Y == Player->TileY) {
-        Enemy->PathLength = i + 1;
+        Path->Length = i + 1;
         break;
       }
     }
   }
 }
 
-void ErasePerson(person *Person) {
+// Moves a looping animation on by one tick
+inline void AdvanceAnimation(const animation *Animation,
+                             animation_playback *Playback) {
+  const frame *Frame = &Animation->Frames[Playback->Frame];
+  if (Playback->Counter >= Frame->Lasting) {
+    Playback->Counter = 0;
+    Playback->Frame = (u8)((Playback->Frame + 1) % Animation->FrameCount);
+  }
+  Playback->Counter++;
+}
+
+void ErasePerson(game_state *State, person *Person) {
   // Redraw tiles covered by person
   for (int Row = Person->TileY - 1; Row <= Person->TileY + 1; Row++) {
     for (int Col = Person->TileX - 1; Col <= Person->TileX + 1; Col++) {
-      DrawTile(Col, Row);
+      InvalidateTile(State, Col, Row);
     }
   }
 }
 
-void AddScore(int Value) {
-  gScore += Value;
-  gUpdateScore = true;
+void AddScore(game_state *State, int Value) {
+  const int MaxScore = 99999999;
+  State->Sim.Score += Value;
+  if (State->Sim.Score > MaxScore) {
+    State->Sim.Score = MaxScore;
+  }
+  if (State->Sim.Score < 0) {
+    State->Sim.Score = 0;
+  }
+  State->UpdateScore = true;
 }
 
-void KillPlayer(person *Player) {
+void KillPlayer(game_state *State, person *Player) {
+  game_stats *Stats = &State->Sim.Stats;
+  if (Stats->Deaths == 0) {
+    Stats->FirstDeathTick = Stats->Ticks;
+  }
+  Stats->Deaths++;
+
   Player->IsDead = true;
-  gDeadWait = 150;  // 2.5 sec
-  AddScore(-2150);
-  PlaySound(&gSound.Death);
+  State->Sim.DeadWait = 150;  // 2.5 sec
+  AddScore(State, -2150);
+  PlaySound(State, &State->Sound.Death);
 
-  gClock = false;
+  State->Sim.Clock = false;
 }
 
-void UpdatePerson(person *Person, bool32 IsEnemy, int Speed, bool32 PressedUp,
-                  bool32 PressedDown, bool32 PressedLeft, bool32 PressedRight,
-                  bool32 PressedFire, bool32 Turbo) {
+void UpdatePerson(game_state *State, person *Person, bool32 IsEnemy, int Speed,
+                  bool32 PressedUp, bool32 PressedDown, bool32 PressedLeft,
+                  bool32 PressedRight, bool32 PressedFire, bool32 Turbo) {
+  level *Level = &State->Sim.Level;
   bool32 Animate = false;
 
   int OldX = Person->X;
@@ -962,22 +1277,22 @@ void UpdatePerson(person *Person, bool32 IsEnemy, int Speed, bool32 PressedUp,
     int Right = (Person->X + Person->Width / 2) / kTileWidth;
     int Top = (Person->Y - Person->Height / 2) / kTileHeight;
     int Bottom = (Person->Y + Person->Height / 2) / kTileHeight;
-    if (CheckTile(Left, Top) == LVL_LADDER ||
-        CheckTile(Left, Bottom) == LVL_LADDER) {
+    if ((TileFlags(State, Left, Top) & TileFlag_Climbable) ||
+        (TileFlags(State, Left, Bottom) & TileFlag_Climbable)) {
       OnLadder = true;
       LadderTileX = Left;
-    } else if (CheckTile(Right, Top) == LVL_LADDER ||
-               CheckTile(Right, Bottom) == LVL_LADDER) {
+    } else if ((TileFlags(State, Right, Top) & TileFlag_Climbable) ||
+               (TileFlags(State, Right, Bottom) & TileFlag_Climbable)) {
       OnLadder = true;
       LadderTileX = Right;
     }
     if (Person->ParalyseImmunityCooldown > 0 && OnLadder == false) {
-      if (CheckTile(Left, Top) == LVL_BLANK_TMP ||
-          CheckTile(Left, Bottom) == LVL_BLANK_TMP) {
+      if (CheckTile(State, Left, Top) == LVL_BLANK_TMP ||
+          CheckTile(State, Left, Bottom) == LVL_BLANK_TMP) {
         OnLadder = true;
         LadderTileX = Left;
-      } else if (CheckTile(Right, Top) == LVL_BLANK_TMP ||
-                 CheckTile(Right, Bottom) == LVL_BLANK_TMP) {
+      } else if (CheckTile(State, Right, Top) == LVL_BLANK_TMP ||
+                 CheckTile(State, Right, Bottom) == LVL_BLANK_TMP) {
         OnLadder = true;
         LadderTileX = Right;
       }
@@ -990,9 +1305,9 @@ void UpdatePerson(person *Person, bool32 IsEnemy, int Speed, bool32 PressedUp,
     int Row = Person->TileY + 1;
     int PersonBottom = (int)Person->Y + Person->Height / 2;
     int TileTop = Row * kTileHeight;
-    if (CheckTile(Col, Row) == LVL_LADDER ||
+    if ((TileFlags(State, Col, Row) & TileFlag_Climbable) ||
         (Person->ParalyseImmunityCooldown > 0 &&
-         CheckTile(Col, Row) == LVL_BLANK_TMP)) {
+         CheckTile(State, Col, Row) == LVL_BLANK_TMP)) {
       if (PersonBottom >= TileTop) LadderBelow = true;
     }
   }
@@ -1004,7 +1319,7 @@ void UpdatePerson(person *Person, bool32 IsEnemy, int Speed, bool32 PressedUp,
   }
 
   Person->OnRope = false;
-  if (CheckTile(Person->TileX, Person->TileY) == LVL_ROPE) {
+  if (TileFlags(State, Person->TileX, Person->TileY) & TileFlag_Hangable) {
     int RopeY = Person->TileY * kTileHeight;
     int PersonTop = Person->Y - Person->Height / 2;
     Person->OnRope = (PersonTop == RopeY) ||
@@ -1021,21 +1336,21 @@ void UpdatePerson(person *Person, bool32 IsEnemy, int Speed, bool32 PressedUp,
   {
     int Old = Person->Y;
     Person->Y += Speed;
-    if (!AcceptableMove(Person, IsEnemy) || OnLadder || LadderBelow || Turbo ||
-        Person->OnRope) {
+    if (!AcceptableMove(State, Person, IsEnemy) || OnLadder || LadderBelow ||
+        Turbo || Person->OnRope) {
       Person->Y = Old;
       Person->IsFalling = false;
     } else {
       Person->IsFalling = true;
       Animate = true;
-      Person->Animation = &Person->Falling;
+      Person->Animation = PersonAnimation_Falling;
     }
   }
 
   // Adjust in a player-made pit
   if (Person->IsFalling && !WasFalling) {
-    for (int i = Person->TileY + 1; i < Level.Height; i++) {
-      if (CheckTile(Person->TileX, i) == LVL_BLANK_TMP) {
+    for (int i = Person->TileY + 1; i < Level->Height; i++) {
+      if (CheckTile(State, Person->TileX, i) == LVL_BLANK_TMP) {
         Person->X = Person->TileX * kTileWidth + kTileWidth / 2;
         break;
       }
@@ -1046,18 +1361,20 @@ void UpdatePerson(person *Person, bool32 IsEnemy, int Speed, bool32 PressedUp,
   if (PressedRight && (!Person->IsFalling || Turbo)) {
     int Old = Person->X;
     Person->X += Speed;
-    if (!AcceptableMove(Person, IsEnemy)) {
+    if (!AcceptableMove(State, Person, IsEnemy)) {
       Person->X = Old;
     } else {
       if (!Person->OnRope) {
-        Person->Animation = &Person->GoingRight;
+        Person->Animation = PersonAnimation_GoingRight;
       } else {
-        Person->Animation = &Person->RopeRight;
+        Person->Animation = PersonAnimation_RopeRight;
       }
       // Adjust so it's easy to grab a rope
       if (!IsEnemy && !PressedUp && !PressedDown &&
-          CheckTile(Person->TileX, Person->TileY) == LVL_LADDER &&
-          CheckTile(Person->TileX + 1, Person->TileY) == LVL_ROPE) {
+          (TileFlags(State, Person->TileX, Person->TileY) &
+           TileFlag_Climbable) &&
+          (TileFlags(State, Person->TileX + 1, Person->TileY) &
+           TileFlag_Hangable)) {
         int PersonTop = Person->Y - Person->Height / 2;
         int RopeY = Person->TileY * kTileHeight;
         if (Abs(PersonTop - RopeY) < 10) {
@@ -1072,19 +1389,21 @@ void UpdatePerson(person *Person, bool32 IsEnemy, int Speed, bool32 PressedUp,
   if (PressedLeft && (!Person->IsFalling || Turbo)) {
     int Old = Person->X;
     Person->X -= Speed;
-    if (!AcceptableMove(Person, IsEnemy)) {
+    if (!AcceptableMove(State, Person, IsEnemy)) {
       Person->X = Old;
     } else {
       if (!Person->OnRope) {
-        Person->Animation = &Person->GoingLeft;
+        Person->Animation = PersonAnimation_GoingLeft;
       } else {
-        Person->Animation = &Person->RopeLeft;
+        Person->Animation = PersonAnimation_RopeLeft;
       }
       // @copypaste
       // Adjust so it's easy to grab a rope
       if (!IsEnemy && !PressedUp && !PressedDown &&
-          CheckTile(Person->TileX, Person->TileY) == LVL_LADDER &&
-          CheckTile(Person->TileX - 1, Person->TileY) == LVL_ROPE) {
+          (TileFlags(State, Person->TileX, Person->TileY) &
+           TileFlag_Climbable) &&
+          (TileFlags(State, Person->TileX - 1, Person->TileY) &
+           TileFlag_Hangable)) {
         int PersonTop = Person->Y - Person->Height / 2;
         int RopeY = Person->TileY * kTileHeight;
         if (Abs(PersonTop - RopeY) < 10) {
@@ -1102,7 +1421,7 @@ void UpdatePerson(person *Person, bool32 IsEnemy, int Speed, bool32 PressedUp,
     Person->Y -= Speed;
 
     // @refactor?
-    int PlayerTile = CheckTile(Person->TileX, Person->TileY);
+    int PlayerTile = CheckTile(State, Person->TileX, Person->TileY);
     int PersonBottom = (int)Person->Y + Person->Height / 2;
 
     bool32 GotFlying =
@@ -1110,24 +1429,26 @@ void UpdatePerson(person *Person, bool32 IsEnemy, int Speed, bool32 PressedUp,
          PlayerTile == LVL_ROPE) &&
         (PersonBottom < (Person->TileY + 1) * kTileHeight);
 
-    if (!AcceptableMove(Person, IsEnemy) || GotFlying && !Turbo) {
+    if (!AcceptableMove(State, Person, IsEnemy) || GotFlying && !Turbo) {
       Person->Y = Old;
 
       // Check if we won
-      if (!IsEnemy && Level.AllTreasuresCollected && OnLadder &&
+      if (!IsEnemy && Level->AllTreasuresCollected && OnLadder &&
           Person->Y <= Person->Height / 2) {
-        Level.Index++;
-        if (Level.Index == kLevelCount) {
-          exit(0);
+        State->Sim.Stats.LevelsCompleted++;
+        Level->Index++;
+        if (Level->Index == kLevelCount) {
+          State->Sim.IsFinished = true;
+          return;
         }
-        AddScore(Level.EnemyCount * Level.TreasureCount * 100);
-        PlaySound(&gSound.Win);
-        Level.IsDisappearing = true;
+        AddScore(State, Level->EnemyCount * Level->TreasureCount * 100);
+        PlaySound(State, &State->Sound.Win);
+        Level->IsDisappearing = true;
         return;
       }
     } else {
       Climbing = true;
-      Person->Animation = &Person->Climbing;
+      Person->Animation = PersonAnimation_Climbing;
       Animate = true;
     }
   }
@@ -1136,7 +1457,7 @@ void UpdatePerson(person *Person, bool32 IsEnemy, int Speed, bool32 PressedUp,
   if (Person->CanClimb || LadderBelow || Person->OnRope || Turbo) {
     int Old = Person->Y;
     Person->Y += Speed;
-    if (AcceptableMove(Person, IsEnemy)) {
+    if (AcceptableMove(State, Person, IsEnemy)) {
       Person->CanDescend = true;
     }
     Person->Y = Old;
@@ -1146,7 +1467,7 @@ void UpdatePerson(person *Person, bool32 IsEnemy, int Speed, bool32 PressedUp,
   if (PressedDown && Person->CanDescend) {
     Person->Y += Speed;
     Descending = true;
-    Person->Animation = &Person->Climbing;
+    Person->Animation = PersonAnimation_Climbing;
     Animate = true;
   }
 
@@ -1172,8 +1493,8 @@ void UpdatePerson(person *Person, bool32 IsEnemy, int Speed, bool32 PressedUp,
 
   // Check for collisions with enemies
   if (Person->BumpCooldown <= 0) {
-    for (int i = 0; i < Level.EnemyCount; i++) {
-      enemy *Enemy = &Level.Enemies[i];
+    for (int i = 0; i < Level->EnemyCount; i++) {
+      enemy *Enemy = &Level->Enemies[i];
       if (Enemy == (enemy *)Person) continue;
 
       // Use a larger bounding rect
@@ -1235,25 +1556,25 @@ void UpdatePerson(person *Person, bool32 IsEnemy, int Speed, bool32 PressedUp,
     }
     Assert(TileX != -10);
 
-    int TileToBreak = CheckTile(TileX, TileY);
-    int TileAbove = CheckTile(TileX, TileY - 1);
+    int TileToBreak = CheckTile(State, TileX, TileY);
+    int TileAbove = CheckTile(State, TileX, TileY - 1);
 
-    if (TileToBreak == LVL_BRICK && TileAbove != LVL_BRICK &&
-        TileAbove != LVL_BRICK_HARD && TileAbove != LVL_LADDER) {
+    if ((kTileFlags[TileToBreak] & TileFlag_Diggable) &&
+        !(kTileFlags[TileAbove] & (TileFlag_Solid | TileFlag_Climbable))) {
       // Adjust the Person
       Person->X += AdjustPersonX;
 
       // Crush the brick
-      Level.Contents[TileY][TileX] = LVL_BLANK_TMP;
-      DrawTile(TileX, TileY);
+      PutTile(State, TileX, TileY, LVL_BLANK_TMP);
+      InvalidateTile(State, TileX, TileY);
       Person->FireCooldown = 30;
-      PlaySound(&gSound.Crush);
+      PlaySound(State, &State->Sound.Crush);
 
       // Remember that
       crushed_brick *Brick =
-          &Level.CrushedBricks[Level.NextCrushedBrickAvailable];
-      Level.NextCrushedBrickAvailable =
-          (Level.NextCrushedBrickAvailable + 1) % kCrushedBrickCount;
+          &Level->CrushedBricks[Level->NextCrushedBrickAvailable];
+      Level->NextCrushedBrickAvailable =
+          (Level->NextCrushedBrickAvailable + 1) % kCrushedBrickCount;
 
       Assert(Brick->IsUsed == false);
 
@@ -1265,23 +1586,9 @@ void UpdatePerson(person *Person, bool32 IsEnemy, int Speed, bool32 PressedUp,
       Brick->State = Brick->CRUSHING;
       Brick->Countdown = 60 * 8;  // 8 seconds
 
-      // Init animation
-      animation *Animation = NULL;
-
-      Animation = &Brick->Breaking;
-      Animation->FrameCount = 3;
-      Animation->Frame = 0;
-      Animation->Frames[0] = {96, 32, 2};
-      Animation->Frames[1] = {128, 32, 2};
-      Animation->Frames[2] = {160, 32, 2};
-
-      Animation = &Brick->Restoring;
-      Animation->FrameCount = 4;
-      Animation->Frame = 0;
-      Animation->Frames[0] = {192, 0, 8};
-      Animation->Frames[1] = {192, 32, 8};
-      Animation->Frames[2] = {192, 64, 8};
-      Animation->Frames[3] = {192, 96, 8};
+      // Restart the animations
+      Brick->Playback[BrickAnimation_Breaking].Frame = 0;
+      Brick->Playback[BrickAnimation_Restoring].Frame = 0;
     }
   }
   if (Person->FireCooldown > 0) Person->FireCooldown--;
@@ -1289,99 +1596,42 @@ void UpdatePerson(person *Person, bool32 IsEnemy, int Speed, bool32 PressedUp,
   // Death?
   if (!IsEnemy) {
     int kRectAdjust = 5;
-    for (int enemy_num = 0; enemy_num < Level.EnemyCount; enemy_num++) {
-      enemy *Enemy = &Level.Enemies[enemy_num];
+    for (int enemy_num = 0; enemy_num < Level->EnemyCount; enemy_num++) {
+      enemy *Enemy = &Level->Enemies[enemy_num];
       if (EntitiesCollide(Person, Enemy, -kRectAdjust, -kRectAdjust)) {
-        KillPlayer(Person);
+        KillPlayer(State, Person);
       }
     }
   }
 }
 
-extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
-  //======================================================
-  // Initialise stuff
-  //======================================================
-
-  // Update global vars
-  GameBackBuffer = Buffer;
-  GameMemory = Memory;
-
-  // Load sprites
-  if (gImage == NULL) {
-    gImage = LoadSprite("img/sprites.bmp");
-  }
-
-  // Load sounds
-  if (!gSound.IsInitialized) {
-    gSound.IsInitialized = true;
-    gSound.Crush = ReadWAVFile("crush.wav");
-    gSound.Death = ReadWAVFile("death.wav");
-    gSound.Hooray = ReadWAVFile("hooray.wav");
-    gSound.Pickup = ReadWAVFile("pickup.wav");
-    gSound.Win = ReadWAVFile("win.wav");
-  }
-  gSoundOutput = SoundOutput;
-
-  // Init first level
-  if (!Level.IsInitialized) {
-    Level.Index = 0;
-
-    LoadLevel(Level.Index);
-  }
-
+// One tick of the game. Nothing is drawn here, only remembered in State->Redraw,
+// so it can run any number of times per frame or without rendering at all.
+internal int UpdateGame(game_state *State, game_input *NewInput) {
+  level *Level = &State->Sim.Level;
   // Tick the dead wait timer early to let it go if the menu is shown
-  if (gDeadWait > 0) {
-    gDeadWait--;
+  if (State->Sim.DeadWait > 0) {
+    State->Sim.DeadWait--;
   }
 
   if (NewInput->Player1.Menu.EndedDown) {
     // Switch it off immediately
     NewInput->Player1.Menu.EndedDown = false;
-    gShowMenu = !gShowMenu;
-    RedrawLevel = true;
-    gMenuKeyPressCooldown = 10;
-  }
-
-  if (RedrawLevel || gShowMenu || (!Level.IsDrawn && Level.TileBeingDrawn == 0)) {
-    // Fill background
-    u32 *Pixel = (u32 *)GameBackBuffer->Memory;
-    for (int i = 0; i < GameBackBuffer->Width * GameBackBuffer->Height; i++) {
-      *Pixel++ = 0x000A0D0B;
-    }
-
-    // Set the offset to draw in the centre
-    {
-      int Left = (GameBackBuffer->Width - Level.Width * kTileWidth) / 2;
-      int Top =
-          (GameBackBuffer->Height - ((Level.Height + 2) * kTileHeight)) / 2;
-      GameBackBuffer->StartOffset =
-          (Top * GameBackBuffer->Width + Left) * GameBackBuffer->BytesPerPixel;
+    State->Sim.ShowMenu = !State->Sim.ShowMenu;
+    State->Sim.MenuKeyPressCooldown = 10;
+    if (!State->Sim.ShowMenu) {
+      // Back to the level, all of it at once
+      Level->IsDrawn = true;
+      State->Redraw.Screen = true;
     }
   }
 
   //======================================================
-  // Show menu
+  // Menu
   //======================================================
 
-  if (gShowMenu) {
-    DrawText("select level", 5 * kTileWidth, 5 * kTileHeight);
-    DrawText("close lode runner", 5 * kTileWidth, 19 * kTileHeight);
-
-    int NumbersInRow = 5;
-    int Row = 0;
-    int Col = 0;
-
-    // Draw level numbers
-    for (int i = 1; i < kLevelCount; i++) {
-      DrawNumber(i, 5 + Col * 3, 9 + Row * 3);
-      Col++;
-
-      if (Col == NumbersInRow) {
-        Row++;
-        Col = 0;
-      }
-    }
+  if (State->Sim.ShowMenu) {
+    int NumbersInRow = kLevelsInMenuRow;
 
     // Get input
     player_input *Input = &NewInput->Players[0];
@@ -1396,194 +1646,114 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
     bool32 PressedAnyKey =
         PressedDown || PressedUp || PressedLeft || PressedRight;
 
-    if (gSelectedLevel > 0 && PressedAnyKey && gMenuKeyPressCooldown == 0) {
+    if (State->Sim.SelectedLevel > 0 && PressedAnyKey &&
+        State->Sim.MenuKeyPressCooldown == 0) {
       if (PressedDown) {
-        if (gSelectedLevel + NumbersInRow <= kLevelCount - 1 ||
-            (gSelectedLevel - 1) / NumbersInRow ==
+        if (State->Sim.SelectedLevel + NumbersInRow <= kLevelCount - 1 ||
+            (State->Sim.SelectedLevel - 1) / NumbersInRow ==
                 (kLevelCount - 1 - 1) / NumbersInRow) {
-          gSelectedLevel += NumbersInRow;
+          State->Sim.SelectedLevel += NumbersInRow;
         }
         else {
-          gSelectedLevel = kLevelCount - 1;
+          State->Sim.SelectedLevel = kLevelCount - 1;
         }
       }
       if (PressedUp) {
-        gSelectedLevel -= NumbersInRow;
+        State->Sim.SelectedLevel -= NumbersInRow;
       }
       if (PressedRight) {
-        gSelectedLevel += 1;
+        State->Sim.SelectedLevel += 1;
       }
       if (PressedLeft) {
-        gSelectedLevel -= 1;
+        State->Sim.SelectedLevel -= 1;
       }
 
-      if (gSelectedLevel < 0 || gSelectedLevel > kLevelCount - 1) {
-        gSelectedLevel = 0;
+      if (State->Sim.SelectedLevel < 0 ||
+          State->Sim.SelectedLevel > kLevelCount - 1) {
+        State->Sim.SelectedLevel = 0;
       }
-      gMenuKeyPressCooldown = 10;
-    } else if (gSelectedLevel == 0 && PressedAnyKey &&
-               gMenuKeyPressCooldown == 0) {
+      State->Sim.MenuKeyPressCooldown = 10;
+    } else if (State->Sim.SelectedLevel == 0 && PressedAnyKey &&
+               State->Sim.MenuKeyPressCooldown == 0) {
       if (PressedDown || PressedRight) {
-        gSelectedLevel = 1;
+        State->Sim.SelectedLevel = 1;
       }
       if (PressedUp) {
-        gSelectedLevel = ((kLevelCount - 1) / NumbersInRow) * NumbersInRow + 1;
+        State->Sim.SelectedLevel =
+            ((kLevelCount - 1) / NumbersInRow) * NumbersInRow + 1;
       }
       if (PressedLeft) {
-        gSelectedLevel = kLevelCount - 1;
+        State->Sim.SelectedLevel = kLevelCount - 1;
       }
-      gMenuKeyPressCooldown = 10;
+      State->Sim.MenuKeyPressCooldown = 10;
     }
 
-    if (PressedFire && gMenuKeyPressCooldown == 0) {
-      if (gSelectedLevel == 0) {
+    if (PressedFire && State->Sim.MenuKeyPressCooldown == 0) {
+      if (State->Sim.SelectedLevel == 0) {
         return 1;
       } else {
-        Level.Index = gSelectedLevel - 1;
-        LoadLevel(Level.Index);
-        gShowMenu = false;
+        Level->Index = State->Sim.SelectedLevel - 1;
+        LoadLevel(State, Level->Index);
+        State->Sim.ShowMenu = false;
         return 0;
       }
     }
 
-    if (gMenuKeyPressCooldown > 0) {
-      gMenuKeyPressCooldown--;
-    }
-
-    // Draw cursor
-    if (gSelectedLevel > 0) {
-      int SelectedCol = (gSelectedLevel - 1) % NumbersInRow;
-      int SelectedRow = (gSelectedLevel - 1) / NumbersInRow;
-      int X = (5 + SelectedCol * 3) * kTileWidth;
-      int Y = (9 + SelectedRow * 3) * kTileHeight;
-      DrawSprite({X - 8, Y - 8}, 10, 10, 224, 160);
-      DrawSprite({X - 8, Y + kTileHeight - 2}, 10, 10, 224, 160 + 22);
-      DrawSprite({X + kTileWidth * 2 - 2, Y - 8}, 10, 10, 224 + 22, 160);
-      DrawSprite({X + kTileWidth * 2 - 2, Y + kTileHeight - 2}, 10, 10,
-                 224 + 22, 160 + 22);
-    } else {
-      int X = 5 * kTileWidth;
-      int Y = 19 * kTileHeight;
-      DrawSprite({X - 8, Y - 8}, 10, 10, 224, 160);
-      DrawSprite({X - 8, Y + kTileHeight - 2}, 10, 10, 224, 160 + 22);
-      DrawSprite({X + kTileWidth * 17 - 2, Y - 8}, 10, 10, 224 + 22, 160);
-      DrawSprite({X + kTileWidth * 17 - 2, Y + kTileHeight - 2}, 10, 10,
-                 224 + 22, 160 + 22);
+    if (State->Sim.MenuKeyPressCooldown > 0) {
+      State->Sim.MenuKeyPressCooldown--;
     }
 
     return 0;  // don't go further
   }
 
   //======================================================
-  // Draw level
+  // Reveal the level
   //======================================================
 
-  bool32 DrawFooter = false;
-
-  if (RedrawLevel) {
-    // Draw the whole level in one go
-    for (int Row = 0; Row < Level.Height; ++Row) {
-      for (int Col = 0; Col < Level.Width; ++Col) {
-        DrawTile(Col, Row);
-      }
-    }
-    Level.IsDrawn = true;
-    DrawFooter = true;
-  }
-
-  if (!Level.IsDrawn) {
-    // Draw the level line by line
-    for (int i = 0; i < Level.DrawTilesPerFrame; i++) {
-      int Col = Level.TileBeingDrawn % Level.Width;
-      int Row = Level.TileBeingDrawn / Level.Width;
-      DrawTile(Col, Row);
-      Level.TileBeingDrawn++;
-      if (Level.TileBeingDrawn >= Level.Width * Level.Height) {
-        Level.IsDrawn = true;
-        DrawFooter = true;
+  if (!Level->IsDrawn) {
+    // Line by line, the game starts once all of it is there
+    int TileCount = Level->Width * Level->Height;
+    for (int i = 0; i < Level->DrawTilesPerFrame; i++) {
+      InvalidateTile(State, Level->TileBeingDrawn % Level->Width,
+                     Level->TileBeingDrawn / Level->Width);
+      Level->TileBeingDrawn++;
+      if (Level->TileBeingDrawn >= TileCount) {
+        Level->IsDrawn = true;
+        State->Redraw.Footer = true;
         break;
       }
     }
-    if (!Level.IsDrawn) {
+    if (!Level->IsDrawn) {
       // if still not drawn
       return 0;
     }
   }
 
-  if (Level.IsDisappearing) {
-    animation *Animation = &Level.Disappearing;
-    frame *Frame = &Animation->Frames[Animation->Frame];
+  if (Level->IsDisappearing) {
+    const animation *Animation = &kDisappearingAnimation;
+    animation_playback *Playback = &Level->Disappearing;
+    const frame *Frame = &Animation->Frames[Playback->Frame];
 
-    v2i Position = {};
-    for (int Row = 0; Row < Level.Height; Row++) {
-      for (int Col = 0; Col < Level.Width; Col++) {
-        Position.x = Col * kTileWidth;
-        Position.y = Row * kTileHeight;
-        DrawSprite(Position, kTileWidth, kTileHeight, Frame->XOffset,
-                   Frame->YOffset);
-      }
-    }
-
-    if (Animation->Counter > Frame->Lasting) {
-      Animation->Counter = 0;
-      Animation->Frame++;
+    if (Playback->Counter > Frame->Lasting) {
+      Playback->Counter = 0;
+      Playback->Frame++;
     }
-    Animation->Counter += 1;
+    Playback->Counter++;
 
-    if (Animation->Frame >= Animation->FrameCount) {
-      Level.IsDisappearing = false;
-      LoadLevel(Level.Index);
+    if (Playback->Frame >= Animation->FrameCount) {
+      Level->IsDisappearing = false;
+      LoadLevel(State, Level->Index);
     }
     return 0;
   }
 
-  if (DrawFooter) {
-    int LevelBottomY = Level.Height * kTileHeight + kTileHeight / 4;
-    DrawRectangle(0, LevelBottomY + 2, kTileWidth * Level.Width,
-                  kTileHeight / 2, 0x009C659C);
-    LevelBottomY += kTileHeight - 4;
-    DrawText("score", 0, LevelBottomY);
-    DrawText("level", (Level.Width - 8) * kTileWidth, LevelBottomY);
-
-    char LevelString[3] = "00";
-    LevelString[2] = 0;
-    LevelString[1] = (char)('0' + (Level.Index + 1) % 10);
-    LevelString[0] = (char)('0' + ((Level.Index + 1) / 10) % 10);
-    DrawText(LevelString, (Level.Width - 2) * kTileWidth, LevelBottomY);
-    gUpdateScore = true;
-
-    // DrawText("iliok", 17 * kTileWidth, LevelBottomY);
-  }
-
-  // Draw score
-  if (gUpdateScore) {
-    gUpdateScore = false;
-    const int MaxScore = 99999999;
-    if (gScore > MaxScore) {
-      gScore = MaxScore;
-    }
-    if (gScore < 0) {
-      gScore = 0;
-    }
-    char String[9] = "00000000";
-    int i = 7;  // last digit index
-    int value = gScore;
-    while (i >= 0) {
-      String[i] = (char)('0' + value % 10);
-      value /= 10;
-      i--;
-    }
-    DrawText(String, 6 * kTileWidth,
-             Level.Height * kTileHeight + kTileHeight / 4 + kTileHeight - 4);
-  }
-
   //======================================================
   // Updates
   //======================================================
 
   // Update players
   for (int i = 0; i < 2; i++) {
-    player *Player = &Level.Players[i];
+    player *Player = &Level->Players[i];
     if (!Player->IsActive) {
       continue;
     }
@@ -1603,14 +1773,14 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
     bool32 PressedAnyKey =
         PressedFire || PressedDown || PressedUp || PressedLeft || PressedRight;
 
-    if (Player->IsDead && gDeadWait <= 0) {
-      gClock = true;
-      Level.IsDisappearing = true;
+    if (Player->IsDead && State->Sim.DeadWait <= 0) {
+      State->Sim.Clock = true;
+      Level->IsDisappearing = true;
       return 0;
     }
-    if (!gClock) return 0;
+    if (!State->Sim.Clock) return 0;
 
-    ErasePerson(Player);
+    ErasePerson(State, Player);
 
 #ifdef BUILD_INTERNAL
     // Turbo
@@ -1620,30 +1790,35 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
     }
 #endif
 
-    if (!Level.HasStarted) {
+    if (!Level->HasStarted) {
       for (int button = 0; button < INPUT_BUTTON_COUNT; button++) {
         if (Input->Buttons[button].EndedDown) {
-          Level.HasStarted = true;
+          Level->HasStarted = true;
           // Prevent player from disappearing
-          Player->Animation = &Player->Falling;
+          Player->Animation = PersonAnimation_Falling;
           break;
         }
       }
     }
-    if (!Level.HasStarted) break;
+    if (!Level->HasStarted) break;
 
     bool32 IsEnemy = false;
-    UpdatePerson(Player, IsEnemy, Speed, PressedUp, PressedDown, PressedLeft,
-                 PressedRight, PressedFire, Turbo);
+    UpdatePerson(State, Player, IsEnemy, Speed, PressedUp, PressedDown,
+                 PressedLeft, PressedRight, PressedFire, Turbo);
+  }
+
+  if (State->Sim.IsFinished) {
+    return 1;  // all levels done
   }
 
   // Update enemies
-  for (int i = 0; i < Level.EnemyCount; i++) {
-    enemy *Enemy = &Level.Enemies[i];
+  for (int i = 0; i < Level->EnemyCount; i++) {
+    enemy *Enemy = &Level->Enemies[i];
+    enemy_path *Path = &Level->EnemyPaths[i];
 
-    if (!Level.HasStarted) break;
+    if (!Level->HasStarted) break;
 
-    ErasePerson(Enemy);
+    ErasePerson(State, Enemy);
 
     bool32 Animate = false;
     int Speed = 2;
@@ -1651,14 +1826,15 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
     int kPathCooldown = 30;
 
     if (Enemy->IsDead) {
-      AddScore(245);
+      AddScore(State, 245);
 
       Enemy->IsDead = false;
       Enemy->IsParalysed = false;
       Enemy->ParalyseCooldown = 0;
       Enemy->ParalyseImmunityCooldown = 0;
 
-      v2i Position = Level.Respawns[randint(Level.RespawnCount)];
+      int Respawn = RandomChoice(&Level->Random, Level->RespawnCount);
+      v2i Position = Level->Respawns[Respawn];
 
       Enemy->TileX = Position.x;
       Enemy->TileY = Position.y;
@@ -1672,38 +1848,34 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
       Enemy->PathCooldown = 0;  // build a path
     }
 
-    player *Player = Enemy->Pursuing;
-    if (Player == NULL || Enemy->PathCooldown <= 0) {
-      if (gDebug) {
+    if (Enemy->Pursuing < 0 || Enemy->PathCooldown <= 0) {
+      if (State->Sim.Debug) {
         // Erase old drawn path
-        if (Enemy->PathExists) {
-          for (int j = 0; j < Enemy->PathLength; j++) {
-            DrawTile(Enemy->Path[j].x, Enemy->Path[j].y);
+        if (Path->Exists) {
+          for (int j = 0; j < Path->Length; j++) {
+            InvalidateTile(State, Path->Points[j].x, Path->Points[j].y);
           }
         }
       }
       // Choose a player to pursue
-      if (Level.PlayerCount > 1) {
-        player *Player1 = &Level.Players[0];
-        player *Player2 = &Level.Players[1];
+      Enemy->Pursuing = 0;
+      if (Level->PlayerCount > 1) {
+        player *Player1 = &Level->Players[0];
+        player *Player2 = &Level->Players[1];
 
         if (Abs(Player1->TileX - Enemy->TileX) +
-                Abs(Player1->TileY - Enemy->TileY) <
+                Abs(Player1->TileY - Enemy->TileY) >=
             Abs(Player2->TileX - Enemy->TileX) +
                 Abs(Player2->TileY - Enemy->TileY)) {
-          Player = Player1;
-        } else {
-          Player = Player2;
+          Enemy->Pursuing = 1;
         }
-      } else {
-        Player = &Level.Players[0];
       }
-      Enemy->Pursuing = Player;
 
-      FindPath(Enemy, Player);
+      FindPath(State, Enemy, Path, &Level->Players[Enemy->Pursuing]);
 
       Enemy->PathCooldown = kPathCooldown;
     }
+    player *Player = &Level->Players[Enemy->Pursuing];
 
     Enemy->PathCooldown--;
 
@@ -1715,7 +1887,7 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
       // Check for obstacles
       int Step = Player->TileX < Enemy->TileX ? 1 : -1;
       for (int tile = Player->TileX; tile != Enemy->TileX; tile += Step) {
-        if (!CanGoThroughTile(tile, Player->TileY)) {
+        if (!CanGoThroughTile(State, tile, Player->TileY)) {
           SeesDirectly = false;
         }
       }
@@ -1726,7 +1898,7 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
       // Check for obstacles
       int Step = Player->TileY < Enemy->TileY ? 1 : -1;
       for (int tile = Player->TileY; tile != Enemy->TileY; tile += Step) {
-        if (!CanGoThroughTile(Player->TileX, tile)) {
+        if (!CanGoThroughTile(State, Player->TileX, tile)) {
           SeesDirectly = false;
         }
       }
@@ -1755,22 +1927,22 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
       }
     }
 
-    if (Enemy->PathExists && Enemy->BumpCooldown <= 0) {
-      v2i NextPoint = Enemy->Path[Enemy->PathPointIndex];
+    if (Path->Exists && Enemy->BumpCooldown <= 0) {
+      v2i NextPoint = Path->Points[Path->PointIndex];
       int TargetX = NextPoint.x * kTileWidth + kTileWidth / 2;
       int TargetY = NextPoint.y * kTileHeight + kTileHeight / 2;
 
       // If reached the point
       if (Abs(TargetX - Enemy->X) <= 4 && Abs(TargetY - Enemy->Y) <= 4) {
-        Enemy->PathPointIndex++;
-        NextPoint = Enemy->Path[Enemy->PathPointIndex];
+        Path->PointIndex++;
+        NextPoint = Path->Points[Path->PointIndex];
         TargetX = NextPoint.x * kTileWidth + kTileWidth / 2;
         TargetY = NextPoint.y * kTileHeight + kTileHeight / 2;
       }
 
       // If reached the end of the path
-      if (Enemy->PathPointIndex >= Enemy->PathLength - 1) {
-        Enemy->PathExists = false;
+      if (Path->PointIndex >= Path->Length - 1) {
+        Path->Exists = false;
       }
 
       if (!SeesDirectly) {
@@ -1793,14 +1965,16 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
         }
 
         // Get off ladders easily if needed
-        if (CheckTile(Enemy->TileX, Enemy->TileY) == LVL_LADDER &&
+        if ((TileFlags(State, Enemy->TileX, Enemy->TileY) &
+             TileFlag_Climbable) &&
             Abs(DeltaY) <= 1 && Abs(DeltaX) > 2) {
           Enemy->DirectionY = NOWHERE;
         }
       }
 
       // Don't fall from ropes when not needed
-      if (CheckTile(Enemy->TileX, Enemy->TileY) == LVL_ROPE &&
+      if ((TileFlags(State, Enemy->TileX, Enemy->TileY) &
+           TileFlag_Hangable) &&
           Abs(Player->Y - Enemy->Y) <= 2) {
         Enemy->DirectionY = UP;
       }
@@ -1821,21 +1995,22 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
     }
 
     if (!Enemy->IsParalysed && Enemy->ParalyseImmunityCooldown <= 0 &&
-        CheckTile(Enemy->TileX, Enemy->TileY) == LVL_BLANK_TMP) {
+        CheckTile(State, Enemy->TileX, Enemy->TileY) == LVL_BLANK_TMP) {
       Enemy->IsParalysed = true;
-      AddScore(185);
+      AddScore(State, 185);
       Enemy->ParalyseCooldown = 4 * 60;
     }
 
     // Maybe drop treasure
     if (Enemy->CarriesTreasure >= 0 && (Enemy->X % kTileWidth == 0) &&
-        CheckTile(Enemy->TileX, Enemy->TileY) != LVL_LADDER &&
+        !(TileFlags(State, Enemy->TileX, Enemy->TileY) &
+          TileFlag_Climbable) &&
         Enemy->ParalyseCooldown <= 0) {
-      if (randint(100) < 8) {
+      if (RandomChoice(&Level->Random, 100) < 8) {
         bool32 AnotherTreasureOccupiesThisTile = false;
-        for (int j = 0; j < Level.TreasureCount; j++) {
+        for (int j = 0; j < Level->TreasureCount; j++) {
           if (Enemy->CarriesTreasure == j) continue;
-          treasure *AnotherTreasure = &Level.Treasures[j];
+          treasure *AnotherTreasure = &Level->Treasures[j];
           if (AnotherTreasure->IsCollected) continue;
           if (AnotherTreasure->TileX == Enemy->TileX &&
               AnotherTreasure->TileY == Enemy->TileY) {
@@ -1843,7 +2018,7 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
           }
         }
         if (!AnotherTreasureOccupiesThisTile) {
-          treasure *Treasure = &Level.Treasures[Enemy->CarriesTreasure];
+          treasure *Treasure = &Level->Treasures[Enemy->CarriesTreasure];
           Treasure->IsCollected = false;
           Treasure->X = Enemy->X;
           Treasure->Y = Enemy->TileY * kTileHeight;
@@ -1856,7 +2031,7 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
 
     // If in a pit, drop the treasure
     if (Enemy->CarriesTreasure >= 0 && Enemy->IsParalysed) {
-      treasure *Treasure = &Level.Treasures[Enemy->CarriesTreasure];
+      treasure *Treasure = &Level->Treasures[Enemy->CarriesTreasure];
       Treasure->IsCollected = false;
       Treasure->TileX = Enemy->TileX;
       Treasure->TileY = Enemy->TileY - 1;
@@ -1872,39 +2047,34 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
     bool32 PressedFire = false;
 
     bool32 IsEnemy = true;
-    UpdatePerson(Enemy, IsEnemy, Speed, PressedUp, PressedDown, PressedLeft,
-                 PressedRight, PressedFire, Turbo);
+    UpdatePerson(State, Enemy, IsEnemy, Speed, PressedUp, PressedDown,
+                 PressedLeft, PressedRight, PressedFire, Turbo);
   }
 
-  // Process and draw bricks
+  // Process bricks
   for (int i = 0; i < kCrushedBrickCount; i++) {
-    crushed_brick *Brick = &Level.CrushedBricks[i];
+    crushed_brick *Brick = &Level->CrushedBricks[i];
     if (!Brick->IsUsed) {
       continue;
     }
 
     if (Brick->State == Brick->CRUSHING) {
       // @copypaste
-      animation *Animation = &Brick->Breaking;
-      frame *Frame = &Animation->Frames[Animation->Frame];
+      const animation *Animation = &kBrickAnimations[BrickAnimation_Breaking];
+      animation_playback *Playback = &Brick->Playback[BrickAnimation_Breaking];
+      const frame *Frame = &Animation->Frames[Playback->Frame];
 
-      v2i Position = {};
-      Position.x = Brick->TileX * kTileWidth;
-      Position.y = (Brick->TileY - 1) * kTileHeight;
-      DrawSprite(Position, kTileWidth, kTileHeight * 2, Frame->XOffset,
-                 Frame->YOffset);
-
-      if (Animation->Counter > Frame->Lasting) {
-        Animation->Counter = 0;
-        Animation->Frame++;
+      if (Playback->Counter > Frame->Lasting) {
+        Playback->Counter = 0;
+        Playback->Frame++;
       }
-      if (Animation->Frame >= Animation->FrameCount) {
-        DrawTile(Brick->TileX, Brick->TileY - 1);
-        DrawTile(Brick->TileX, Brick->TileY);
+      if (Playback->Frame >= Animation->FrameCount) {
+        InvalidateTile(State, Brick->TileX, Brick->TileY - 1);
+        InvalidateTile(State, Brick->TileX, Brick->TileY);
         Brick->State = Brick->WAITING;
         continue;
       }
-      Animation->Counter += 1;
+      Playback->Counter++;
     }
 
     if (Brick->State == Brick->WAITING) {
@@ -1916,30 +2086,25 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
 
     if (Brick->State == Brick->RESTORING) {
       // @copypaste
-      animation *Animation = &Brick->Restoring;
-      frame *Frame = &Animation->Frames[Animation->Frame];
-
-      v2i Position = {};
-      Position.x = Brick->TileX * kTileWidth;
-      Position.y = Brick->TileY * kTileHeight;
-      DrawSprite(Position, kTileWidth, kTileHeight, Frame->XOffset,
-                 Frame->YOffset);
+      const animation *Animation = &kBrickAnimations[BrickAnimation_Restoring];
+      animation_playback *Playback = &Brick->Playback[BrickAnimation_Restoring];
+      const frame *Frame = &Animation->Frames[Playback->Frame];
 
-      if (Animation->Counter > Frame->Lasting) {
-        Animation->Counter = 0;
-        Animation->Frame++;
+      if (Playback->Counter > Frame->Lasting) {
+        Playback->Counter = 0;
+        Playback->Frame++;
       }
 
-      if (Animation->Frame >= Animation->FrameCount) {
-        SetTile(Brick->TileX, Brick->TileY, LVL_BRICK);
-        DrawTile(Brick->TileX, Brick->TileY - 1);
-        DrawTile(Brick->TileX, Brick->TileY);
+      if (Playback->Frame >= Animation->FrameCount) {
+        SetTile(State, Brick->TileX, Brick->TileY, LVL_BRICK);
+        InvalidateTile(State, Brick->TileX, Brick->TileY - 1);
+        InvalidateTile(State, Brick->TileX, Brick->TileY);
 
         rect TileRect = GetTileRect(Brick->TileX, Brick->TileY);
 
         // See if we've killed someone
-        for (int e = 0; e < Level.EnemyCount; e++) {
-          enemy *Enemy = &Level.Enemies[e];
+        for (int e = 0; e < Level->EnemyCount; e++) {
+          enemy *Enemy = &Level->Enemies[e];
 
           rect EnemyRect = GetBoundingRect(Enemy);
           if (RectsCollide(EnemyRect, TileRect)) {
@@ -1948,64 +2113,61 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
           }
         }
 
-        for (int p = 0; p < Level.PlayerCount; p++) {
-          player *Player = &Level.Players[p];
+        for (int p = 0; p < Level->PlayerCount; p++) {
+          player *Player = &Level->Players[p];
           rect PlayerRect = GetBoundingRect(Player);
           if (RectsCollide(PlayerRect, TileRect)) {
-            KillPlayer(Player);
+            KillPlayer(State, Player);
           }
         }
 
         Brick->IsUsed = false;
         continue;
       }
-      Animation->Counter += 1;
+      Playback->Counter++;
     }
   }
 
-  //======================================================
-  // Draw moving stuff
-  //======================================================
-
-  // Update and draw treasures
-  for (int i = 0; i < Level.TreasureCount; i++) {
-    treasure *Treasure = &Level.Treasures[i];
+  // Update treasures
+  for (int i = 0; i < Level->TreasureCount; i++) {
+    treasure *Treasure = &Level->Treasures[i];
 
     if (Treasure->IsCollected) continue;
 
     const int kCollectMargin = 10;
 
     // Check if it's being collected
-    for (int j = 0; j < Level.EnemyCount; j++) {
-      enemy *Enemy = &Level.Enemies[j];
+    for (int j = 0; j < Level->EnemyCount; j++) {
+      enemy *Enemy = &Level->Enemies[j];
 
       if (Enemy->CarriesTreasure >= 0) continue;
 
       if (Abs(Enemy->X - (Treasure->X + kTileWidth / 2)) < kCollectMargin &&
           Abs(Enemy->Y - (Treasure->Y + kTileHeight / 2)) < kCollectMargin) {
-        if (randint(100) < 5) {
+        if (RandomChoice(&Level->Random, 100) < 5) {
           Treasure->IsCollected = true;
           Enemy->CarriesTreasure = i;
         }
       }
     }
-    for (int j = 0; j < Level.PlayerCount; j++) {
-      player *Player = &Level.Players[j];
+    for (int j = 0; j < Level->PlayerCount; j++) {
+      player *Player = &Level->Players[j];
       if (Abs(Player->X - (Treasure->X + kTileWidth / 2)) < kCollectMargin &&
           Abs(Player->Y - (Treasure->Y + kTileHeight / 2)) < kCollectMargin) {
         Treasure->IsCollected = true;
-        Level.TreasuresCollected++;
-        AddScore(305);
-        PlaySound(&gSound.Pickup);
-        if (Level.TreasuresCollected == Level.TreasureCount) {
-          PlaySound(&gSound.Hooray);
+        Level->TreasuresCollected++;
+        State->Sim.Stats.TreasuresCollected++;
+        AddScore(State, 305);
+        PlaySound(State, &State->Sound.Pickup);
+        if (Level->TreasuresCollected == Level->TreasureCount) {
+          PlaySound(State, &State->Sound.Hooray);
           // All treasures collected
-          Level.AllTreasuresCollected = true;
-          for (int Row = 0; Row < Level.Height; Row++) {
-            for (int Col = 0; Col < Level.Width; Col++) {
-              if (CheckTile(Col, Row) == LVL_WIN_LADDER) {
-                SetTile(Col, Row, LVL_LADDER);
-                DrawTile(Col, Row);
+          Level->AllTreasuresCollected = true;
+          for (int Row = 0; Row < Level->Height; Row++) {
+            for (int Col = 0; Col < Level->Width; Col++) {
+              if (CheckTile(State, Col, Row) == LVL_WIN_LADDER) {
+                SetTile(State, Col, Row, LVL_LADDER);
+                InvalidateTile(State, Col, Row);
               }
             }
           }
@@ -2015,21 +2177,15 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
 
     int Speed = 4;  // divides kTileHeight, so no problems
 
-    int BottomTile = CheckTile(Treasure->TileX,
-                               (Treasure->Y + Treasure->Height) / kTileHeight);
-
-    // Treasure doesn't fall through the following tiles
-    bool32 AcceptableMove =
-        BottomTile != LVL_BRICK && BottomTile != LVL_BRICK_HARD &&
-        BottomTile != LVL_LADDER && BottomTile != LVL_INVALID &&
-        BottomTile != LVL_BLANK_TMP && BottomTile != LVL_BRICK_FAKE &&
-        BottomTile != LVL_ROPE && BottomTile != LVL_TREASURE_HOLDER;
+    u32 BottomFlags = TileFlags(
+        State, Treasure->TileX, (Treasure->Y + Treasure->Height) / kTileHeight);
+    bool32 AcceptableMove = !(BottomFlags & TileFlag_Supports);
 
     // Check if there's another treasure below - O(n2)
     bool32 TreasureBelow = false;
-    for (int j = 0; j < Level.TreasureCount; j++) {
+    for (int j = 0; j < Level->TreasureCount; j++) {
       if (i == j) continue;
-      treasure *AnotherTreasure = &Level.Treasures[j];
+      treasure *AnotherTreasure = &Level->Treasures[j];
       if (AnotherTreasure->IsCollected) continue;
       if (Treasure->TileX != AnotherTreasure->TileX) continue;
       int Bottom = Treasure->Y + Treasure->Height;
@@ -2043,27 +2199,237 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
     if (AcceptableMove && !TreasureBelow) {
       Treasure->Y += Speed;
       Treasure->TileY = Treasure->Y / kTileHeight;
-      DrawTile(Treasure->TileX, Treasure->TileY);
-      DrawTile(Treasure->TileX, Treasure->TileY + 1);
+      InvalidateTile(State, Treasure->TileX, Treasure->TileY);
+      InvalidateTile(State, Treasure->TileX, Treasure->TileY + 1);
+    }
+  }
+
+  // Advance animations
+  for (int p = 0; p < 2; p++) {
+    player *Player = &Level->Players[p];
+    if (Player->IsActive && Player->Animate) {
+      AdvanceAnimation(&kPlayerAnimations[Player->Animation],
+                       &Player->Playback[Player->Animation]);
+    }
+  }
+  for (int i = 0; i < Level->EnemyCount; i++) {
+    enemy *Enemy = &Level->Enemies[i];
+    if (Enemy->Animate) {
+      AdvanceAnimation(&kEnemyAnimations[Enemy->Animation],
+                       &Enemy->Playback[Enemy->Animation]);
+    }
+  }
+  return 0;
+}
+
+// Draws the game as it is right now, however many ticks it took to get here
+internal void RenderGame(game_state *State, bool32 RedrawLevel) {
+  level *Level = &State->Sim.Level;
+  bool32 CameraMoved = UpdateViewport(State);
+
+  //======================================================
+  // Show menu
+  //======================================================
+
+  if (State->Sim.ShowMenu) {
+    // Fill background
+    PushClear(State->RenderGroup, kBackgroundColor);
+    State->ScoreRun.IsValid = false;
+
+    SetScreenTransform(State);
+    SetRenderLayer(State->RenderGroup, RenderLayer_Interface);
+    DrawText(State, "select level", 5 * kTileWidth, 5 * kTileHeight);
+    DrawText(State, "close lode runner", 5 * kTileWidth, 19 * kTileHeight);
+
+    int NumbersInRow = kLevelsInMenuRow;
+    int Row = 0;
+    int Col = 0;
+
+    // Draw level numbers
+    for (int i = 1; i < kLevelCount; i++) {
+      DrawNumber(State, i, 5 + Col * 3, 9 + Row * 3);
+      Col++;
+
+      if (Col == NumbersInRow) {
+        Row++;
+        Col = 0;
+      }
+    }
+
+    // Draw cursor
+    SetRenderLayer(State->RenderGroup, RenderLayer_Cursor);
+    if (State->Sim.SelectedLevel > 0) {
+      int SelectedCol = (State->Sim.SelectedLevel - 1) % NumbersInRow;
+      int SelectedRow = (State->Sim.SelectedLevel - 1) / NumbersInRow;
+      int X = (5 + SelectedCol * 3) * kTileWidth;
+      int Y = (9 + SelectedRow * 3) * kTileHeight;
+      DrawSprite(State, {X - 8, Y - 8}, 10, 10, 224, 160);
+      DrawSprite(State, {X - 8, Y + kTileHeight - 2}, 10, 10, 224, 160 + 22);
+      DrawSprite(State, {X + kTileWidth * 2 - 2, Y - 8}, 10, 10, 224 + 22, 160);
+      DrawSprite(State, {X + kTileWidth * 2 - 2, Y + kTileHeight - 2}, 10, 10,
+                 224 + 22, 160 + 22);
+    } else {
+      int X = 5 * kTileWidth;
+      int Y = 19 * kTileHeight;
+      DrawSprite(State, {X - 8, Y - 8}, 10, 10, 224, 160);
+      DrawSprite(State, {X - 8, Y + kTileHeight - 2}, 10, 10, 224, 160 + 22);
+      DrawSprite(State, {X + kTileWidth * 17 - 2, Y - 8}, 10, 10, 224 + 22,
+                 160);
+      DrawSprite(State, {X + kTileWidth * 17 - 2, Y + kTileHeight - 2}, 10, 10,
+                 224 + 22, 160 + 22);
+    }
+
+    return;
+  }
+
+  //======================================================
+  // Draw level
+  //======================================================
+
+  if (RedrawLevel) {
+    State->Redraw.Screen = true;
+  }
+  if (State->Redraw.Screen) {
+    // Fill background
+    PushClear(State->RenderGroup, kBackgroundColor);
+    State->ScoreRun.IsValid = false;
+    State->Redraw.View = true;
+    if (Level->IsDrawn) {
+      State->Redraw.Footer = true;
+    }
+  }
+
+  rect VisibleTiles = GetVisibleTiles(State);
+
+  SetWorldTransform(State);
+
+  if (State->Redraw.View || CameraMoved) {
+    // Draw the whole view in one go
+    for (int Row = VisibleTiles.Top; Row < VisibleTiles.Bottom; ++Row) {
+      for (int Col = VisibleTiles.Left; Col < VisibleTiles.Right; ++Col) {
+        if (IsTileRevealed(State, Col, Row)) {
+          DrawTile(State, Col, Row);
+        }
+      }
+    }
+  } else {
+    for (int i = 0; i < State->Redraw.TileCount; i++) {
+      DrawTile(State, State->Redraw.Tiles[i].x, State->Redraw.Tiles[i].y);
+    }
+  }
+  State->Redraw.Screen = false;
+  State->Redraw.View = false;
+  State->Redraw.TileCount = 0;
+
+  if (!Level->IsDrawn) {
+    return;
+  }
+
+  if (Level->IsDisappearing) {
+    SetRenderLayer(State->RenderGroup, RenderLayer_Effects);
+    const frame *Frame =
+        &kDisappearingAnimation.Frames[Level->Disappearing.Frame];
+
+    v2i Position = {};
+    for (int Row = VisibleTiles.Top; Row < VisibleTiles.Bottom; Row++) {
+      for (int Col = VisibleTiles.Left; Col < VisibleTiles.Right; Col++) {
+        Position.x = Col * kTileWidth;
+        Position.y = Row * kTileHeight;
+        DrawSprite(State, Position, kTileWidth, kTileHeight, Frame->XOffset,
+                   Frame->YOffset);
+      }
+    }
+    return;
+  }
+
+  SetScreenTransform(State);
+  SetRenderLayer(State->RenderGroup, RenderLayer_Interface);
+
+  viewport *View = &Level->Viewport;
+
+  if (State->Redraw.Footer) {
+    State->Redraw.Footer = false;
+    int LevelBottomY = View->Height + kTileHeight / 4;
+    DrawRectangle(State, 0, LevelBottomY + 2, View->Width, kTileHeight / 2,
+                  0x009C659C);
+    LevelBottomY += kTileHeight - 4;
+    DrawText(State, "score", 0, LevelBottomY);
+    DrawText(State, "level", View->Width - 8 * kTileWidth, LevelBottomY);
+
+    char LevelString[3] = "00";
+    LevelString[2] = 0;
+    LevelString[1] = (char)('0' + (Level->Index + 1) % 10);
+    LevelString[0] = (char)('0' + ((Level->Index + 1) / 10) % 10);
+    DrawText(State, LevelString, View->Width - 2 * kTileWidth, LevelBottomY);
+    State->UpdateScore = true;
+    State->ScoreRun.IsValid = false;
+
+    // DrawText(State, "iliok", 17 * kTileWidth, LevelBottomY);
+  }
+
+  // Draw score
+  if (State->UpdateScore) {
+    State->UpdateScore = false;
+    char String[9] = "00000000";
+    int i = 7;  // last digit index
+    int value = State->Sim.Score;
+    while (i >= 0) {
+      String[i] = (char)('0' + value % 10);
+      value /= 10;
+      i--;
+    }
+    DrawTextRun(State, &State->ScoreRun, String, 6 * kTileWidth,
+                View->Height + kTileHeight / 4 + kTileHeight - 4);
+  }
+
+  SetWorldTransform(State);
+
+  // Tiles are drawn under the effects, so only draw
+  // the sprite if the tiles aren't being restored
+  SetRenderLayer(State->RenderGroup, RenderLayer_Effects);
+  for (int i = 0; i < kCrushedBrickCount; i++) {
+    crushed_brick *Brick = &Level->CrushedBricks[i];
+    if (!Brick->IsUsed) {
+      continue;
+    }
+
+    v2i Position = {};
+    Position.x = Brick->TileX * kTileWidth;
+    if (Brick->State == Brick->CRUSHING) {
+      const animation *Animation = &kBrickAnimations[BrickAnimation_Breaking];
+      const frame *Frame =
+          &Animation->Frames[Brick->Playback[BrickAnimation_Breaking].Frame];
+      Position.y = (Brick->TileY - 1) * kTileHeight;
+      DrawSprite(State, Position, kTileWidth, kTileHeight * 2, Frame->XOffset,
+                 Frame->YOffset);
+    } else if (Brick->State == Brick->RESTORING) {
+      const animation *Animation = &kBrickAnimations[BrickAnimation_Restoring];
+      const frame *Frame =
+          &Animation->Frames[Brick->Playback[BrickAnimation_Restoring].Frame];
+      Position.y = Brick->TileY * kTileHeight;
+      DrawSprite(State, Position, kTileWidth, kTileHeight, Frame->XOffset,
+                 Frame->YOffset);
     }
   }
 
   // Draw all treasures so they don't blink
-  for (int i = 0; i < Level.TreasureCount; i++) {
-    treasure *Treasure = &Level.Treasures[i];
+  SetRenderLayer(State->RenderGroup, RenderLayer_Treasures);
+  for (int i = 0; i < Level->TreasureCount; i++) {
+    treasure *Treasure = &Level->Treasures[i];
     if (Treasure->IsCollected) continue;
-    DrawSprite(Treasure->Position, kTileWidth, kTileHeight, 96, 96);
+    DrawSprite(State, Treasure->Position, kTileWidth, kTileHeight, 96, 96);
   }
 
-  if (gDebug) {
-    for (int i = 0; i < Level.EnemyCount; i++) {
-      enemy *Enemy = &Level.Enemies[i];
+  if (State->Sim.Debug) {
+    SetRenderLayer(State->RenderGroup, RenderLayer_Debug);
+    for (int i = 0; i < Level->EnemyCount; i++) {
+      enemy_path *Path = &Level->EnemyPaths[i];
 
-      if (Enemy->PathExists) {
-        for (int j = 0; j < Enemy->PathLength - 1; j++) {
-          DrawRectangle(Enemy->Path[j].x * kTileWidth,
-                        Enemy->Path[j].y * kTileHeight, kTileWidth, kTileHeight,
-                        0x00333333);
+      if (Path->Exists) {
+        for (int j = 0; j < Path->Length - 1; j++) {
+          DrawRectangle(State, Path->Points[j].x * kTileWidth,
+                        Path->Points[j].y * kTileHeight, kTileWidth,
+                        kTileHeight, 0x00333333);
         }
       }
     }
@@ -2074,63 +2440,362 @@ extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
     // We're drawing them in a separate loop so they don't
     // overdraw each other
 
-    player *Player = &Level.Players[p];
+    player *Player = &Level->Players[p];
     if (!Player->IsActive) {
       continue;
     }
 
-    animation *Animation = Player->Animation;
-    frame *Frame = &Animation->Frames[Animation->Frame];
-
-    if (Player->Animate) {
-      if (Animation->Counter >= Frame->Lasting) {
-        Animation->Counter = 0;
-        Animation->Frame = (Animation->Frame + 1) % Animation->FrameCount;
-      }
-      Animation->Counter += 1;
-    }
+    const animation *Animation = &kPlayerAnimations[Player->Animation];
+    const frame *Frame =
+        &Animation->Frames[Player->Playback[Player->Animation].Frame];
 
     // Debug
-    if (gDebug) {
-      DrawRectangle(Player->TileX * kTileWidth, Player->TileY * kTileWidth,
-                    kTileWidth, kTileHeight, 0x00333333);
+    if (State->Sim.Debug) {
+      SetRenderLayer(State->RenderGroup, RenderLayer_Debug);
+      DrawRectangle(State, Player->TileX * kTileWidth,
+                    Player->TileY * kTileWidth, kTileWidth, kTileHeight,
+                    0x00333333);
     }
 
-    Frame = &Animation->Frames[Animation->Frame];
+    SetRenderLayer(State->RenderGroup, RenderLayer_Players);
+
     v2i Position = {Player->X - Player->Width / 2,
                     Player->Y - Player->Height / 2};
-    DrawSprite(Position, Player->Width, Player->Height, Frame->XOffset,
+    DrawSprite(State, Position, Player->Width, Player->Height, Frame->XOffset,
                Frame->YOffset);
   }
 
   // Draw enemies
-  for (int i = 0; i < Level.EnemyCount; i++) {
-    enemy *Enemy = &Level.Enemies[i];
+  for (int i = 0; i < Level->EnemyCount; i++) {
+    enemy *Enemy = &Level->Enemies[i];
+    enemy_path *Path = &Level->EnemyPaths[i];
 
-    animation *Animation = Enemy->Animation;
-    frame *Frame = &Animation->Frames[Animation->Frame];
-
-    if (Enemy->Animate) {
-      if (Animation->Counter >= Frame->Lasting) {
-        Animation->Counter = 0;
-        Animation->Frame = (Animation->Frame + 1) % Animation->FrameCount;
-      }
-      Animation->Counter += 1;
-    }
+    const animation *Animation = &kEnemyAnimations[Enemy->Animation];
+    const frame *Frame =
+        &Animation->Frames[Enemy->Playback[Enemy->Animation].Frame];
 
-    Frame = &Animation->Frames[Animation->Frame];
     v2i Position = {Enemy->X - Enemy->Width / 2, Enemy->Y - Enemy->Height / 2};
-    DrawSprite(Position, Enemy->Width, Enemy->Height, Frame->XOffset,
+    SetRenderLayer(State->RenderGroup, RenderLayer_Enemies);
+    DrawSprite(State, Position, Enemy->Width, Enemy->Height, Frame->XOffset,
                Frame->YOffset);
 
-    if (gDebug) {
-      if (Enemy->PathExists) {
-        v2i Pos = Enemy->Path[Enemy->PathPointIndex];
+    if (State->Sim.Debug) {
+      SetRenderLayer(State->RenderGroup, RenderLayer_Debug);
+      if (Path->Exists) {
+        v2i Pos = Path->Points[Path->PointIndex];
         Pos.x = Pos.x * kTileWidth + kTileWidth / 2 - 2;
         Pos.y = Pos.y * kTileHeight + kTileHeight / 2 - 2;
-        DrawRectangle(Pos, 4, 4, 0x00FF0000);
+        DrawRectangle(State, Pos, 4, 4, 0x00FF0000);
       }
     }
   }
-  return 0;
+}
+// The game state is always the first thing in the game memory
+internal game_state *GetGameState(game_memory *Memory) {
+  game_state *State = (game_state *)Memory->Start;
+  if (Memory->Free == Memory->Start && Memory->PlatformCommitMemory) {
+    // Nothing is usable yet, not even the state
+    if (!Memory->PlatformCommitMemory(State, (int)sizeof(game_state),
+                                      false)) {
+      Assert(!"Cannot commit the game state");
+      return NULL;
+    }
+  }
+  if (!State->IsInitialized) {
+    Assert(Memory->Free == Memory->Start);
+    Memory->Free = (u8 *)Memory->Start + sizeof(game_state);
+
+    // Whatever's left after the state, levels and frames get a part
+    // each, the permanent arena the rest
+    int Alignment = kArenaAlignment;
+    int StateSize =
+        ((int)sizeof(game_state) + Alignment - 1) & ~(Alignment - 1);
+    u8 *Base = (u8 *)Memory->Start + StateSize;
+    int Size = Memory->MemorySize - StateSize;
+    int LevelSize = GetLevelArenaShare(Memory->MemorySize);
+    int FrameSize = (Size / 8) & ~(Alignment - 1);
+    int PermanentSize = Size - LevelSize - FrameSize;
+    platform_commit_memory *Commit = Memory->PlatformCommitMemory;
+    InitializeArena(&State->Arenas[GameArena_Permanent], Base, PermanentSize,
+                    Commit, false);
+    Base += PermanentSize;
+    InitializeArena(&State->Arenas[GameArena_Level], Base, LevelSize, Commit,
+                    true);
+    Base += LevelSize;
+    InitializeArena(&State->Arenas[GameArena_Frame], Base, FrameSize, Commit,
+                    true);
+
+    State->IsInitialized = true;
+    State->Sim.Clock = true;
+    State->Sim.SelectedLevel = 1;
+    State->UpdateScore = true;
+  }
+  State->Memory = Memory;
+
+  return State;
+}
+
+internal void ReportArenas(game_state *State) {
+  for (int i = 0; i < GameArena_Count; i++) {
+    State->Memory->Arenas[i] = State->Arenas[i];
+  }
+}
+
+// Cheap enough to run every tick, 8 bytes at a time
+internal u64 HashBytes(u64 Hash, void *Data, int Size) {
+  u8 *At = (u8 *)Data;
+  while (Size > 0) {
+    u64 Word = 0;
+    int Count = (Size < 8) ? Size : 8;
+    memcpy(&Word, At, Count);
+    At += Count;
+    Size -= Count;
+
+    Hash ^= Word * 0x87C37B91114253D5ull;
+    Hash = ((Hash << 31) | (Hash >> 33)) * 0x4CF5AD432745937Full;
+  }
+  return Hash;
+}
+
+#define HASH_VALUE(Value) \
+  Hash = HashBytes(Hash, &(Value), (int)sizeof(Value))
+
+// Covers only what the ticks change, and only the parts of the level in
+// use: the viewport follows rendering, and the empty slots never change.
+// Tiles are the level's tiles, which live outside of the sim.
+internal u64 HashGameSim(game_sim *Sim, u8 *Tiles) {
+  level *Level = &Sim->Level;
+  u64 Hash = 0x243F6A8885A308D3ull;
+
+  HASH_VALUE(Sim->IsFinished);
+  HASH_VALUE(Sim->Clock);
+  HASH_VALUE(Sim->DeadWait);
+  HASH_VALUE(Sim->ShowMenu);
+  HASH_VALUE(Sim->SelectedLevel);
+  HASH_VALUE(Sim->MenuKeyPressCooldown);
+  HASH_VALUE(Sim->LevelLoadCount);
+  HASH_VALUE(Sim->Score);
+  HASH_VALUE(Sim->Stats.Ticks);
+
+  HASH_VALUE(Level->HasStarted);
+  HASH_VALUE(Level->Index);
+  HASH_VALUE(Level->IsDrawn);
+  HASH_VALUE(Level->TileBeingDrawn);
+  HASH_VALUE(Level->IsDisappearing);
+  HASH_VALUE(Level->Disappearing);
+  HASH_VALUE(Level->Width);
+  HASH_VALUE(Level->Height);
+
+  HASH_VALUE(Level->PlayerCount);
+  Hash = HashBytes(Hash, Level->Players,
+                   Level->PlayerCount * (int)sizeof(player));
+  HASH_VALUE(Level->EnemyCount);
+  Hash = HashBytes(Hash, Level->Enemies,
+                   Level->EnemyCount * (int)sizeof(enemy));
+  Hash = HashBytes(Hash, Level->EnemyPaths,
+                   Level->EnemyCount * (int)sizeof(enemy_path));
+  HASH_VALUE(Level->TreasureCount);
+  Hash = HashBytes(Hash, Level->Treasures,
+                   Level->TreasureCount * (int)sizeof(treasure));
+  HASH_VALUE(Level->TreasuresCollected);
+  HASH_VALUE(Level->AllTreasuresCollected);
+
+  Hash = HashBytes(Hash, Tiles, GetBorderedTileCount(Level));
+
+  HASH_VALUE(Level->CrushedBricks);
+  HASH_VALUE(Level->NextCrushedBrickAvailable);
+  HASH_VALUE(Level->RespawnCount);
+  HASH_VALUE(Level->Respawns);
+  HASH_VALUE(Level->Random);
+
+  // Spread the last words over every bit
+  Hash ^= Hash >> 33;
+  Hash *= 0xFF51AFD7ED558CCDull;
+  Hash ^= Hash >> 33;
+  return Hash;
+}
+
+#undef HASH_VALUE
+
+extern "C" GAME_UPDATE_AND_RENDER(GameUpdateAndRender) {
+  //======================================================
+  // Initialise stuff
+  //======================================================
+
+  game_state *State = GetGameState(Memory);
+  level *Level = &State->Sim.Level;
+
+  State->BackBuffer = Buffer;
+#if BUILD_INTERNAL
+  DebugGlobalMemory = Memory;
+#endif
+  ResetArena(&State->Arenas[GameArena_Frame]);
+
+  BEGIN_TIMED_BLOCK(GameUpdateAndRender);
+
+  // Load sounds
+  if (!State->Sound.IsInitialized) {
+    State->Sound.IsInitialized = true;
+    State->Sound.Crush = ReadWAVFile(State->Memory, "crush.wav");
+    State->Sound.Death = ReadWAVFile(State->Memory, "death.wav");
+    State->Sound.Hooray = ReadWAVFile(State->Memory, "hooray.wav");
+    State->Sound.Pickup = ReadWAVFile(State->Memory, "pickup.wav");
+    State->Sound.Win = ReadWAVFile(State->Memory, "win.wav");
+  }
+  State->SoundOutput = SoundOutput;
+
+  // Init first level
+  if (!Level->IsInitialized) {
+    // The you win screen has nobody to play it
+    Level->Index = Memory->StartLevel % kPlayableLevelCount;
+
+    LoadLevel(State, Level->Index);
+  }
+
+  //======================================================
+  // Simulate
+  //======================================================
+
+  int Result = 0;
+  {
+    int TickCount = NewInput->TickCount;
+    if (TickCount <= 0) {
+      r32 Ticks =
+          State->Sim.PendingTicks + NewInput->dtForFrame * (r32)kTicksPerSecond;
+
+      // Allow for rounding so that a frame worth exactly one tick gets it
+      TickCount = (int)(Ticks + 0.001f);
+      if (TickCount > kMaxTicksPerFrame) {
+        // Too far behind to catch up, slow down instead
+        TickCount = kMaxTicksPerFrame;
+        Ticks = (r32)TickCount;
+      }
+      State->Sim.PendingTicks = Ticks - (r32)TickCount;
+    }
+
+    for (int Tick = 0; Tick < TickCount && Result == 0; Tick++) {
+      Result = UpdateGame(State, NewInput);
+      State->Sim.Stats.Ticks++;
+      Memory->StateHash = HashGameSim(&State->Sim, State->Tiles);
+    }
+    Memory->Stats = State->Sim.Stats;
+  }
+
+  if (Buffer == NULL) {
+    ReportArenas(State);
+    END_TIMED_BLOCK(GameUpdateAndRender);
+    return Result;
+  }
+
+  //======================================================
+  // Render
+  //======================================================
+
+  memory_arena *PermanentArena = &State->Arenas[GameArena_Permanent];
+
+  // Load sprites, only needed once something is drawn
+  if (State->Image == NULL) {
+    State->Image = LoadSprite(Memory, PermanentArena, "img/sprites.bmp");
+  }
+
+  State->RenderGroup =
+      AllocateRenderGroup(&State->Arenas[GameArena_Frame],
+                          kMaxRenderEntryCount, ResolveTile, State);
+
+  // Set up the native buffer
+  {
+    int Scale = Memory->RenderScale;
+    if (!IsValidRenderScale(Scale)) {
+      Scale = kDefaultRenderScale;
+    }
+
+    if (State->NativeBuffer.Memory == NULL) {
+      State->NativeBuffer.MaxWidth = Buffer->MaxWidth;
+      State->NativeBuffer.MaxHeight = Buffer->MaxHeight;
+      State->NativeBuffer.BytesPerPixel = Buffer->BytesPerPixel;
+      State->NativeBuffer.Memory = PushSize(
+          PermanentArena,
+          Buffer->MaxWidth * Buffer->MaxHeight * Buffer->BytesPerPixel);
+    }
+
+    if (Scale != State->RenderScale) {
+      State->NativeImage = (Scale == 1)
+                               ? State->Image
+                               : DownsampleImage(PermanentArena, State->Image,
+                                                 Scale);
+      if (State->RenderScale != 0) {
+        RedrawLevel = true;
+      }
+      State->RenderScale = Scale;
+    }
+
+    int Width = Buffer->Width / Scale;
+    int Height = Buffer->Height / Scale;
+    if (Width != State->NativeBuffer.Width ||
+        Height != State->NativeBuffer.Height) {
+      if (State->NativeBuffer.Width != 0) {
+        RedrawLevel = true;
+      }
+      State->NativeBuffer.Width = Width;
+      State->NativeBuffer.Height = Height;
+    }
+  }
+
+  // Everything pushed by RenderGame is executed by EndRender
+  BeginRender(State->RenderGroup, Memory, &State->NativeBuffer,
+              State->NativeImage, State->RenderScale);
+  RenderGame(State, RedrawLevel);
+  EndRender(State->RenderGroup);
+
+  UpscaleToOutput(Memory, &State->NativeBuffer, Buffer, State->RenderScale,
+                  kBackgroundColor);
+
+  ReportArenas(State);
+  END_TIMED_BLOCK(GameUpdateAndRender);
+
+  return Result;
+}
+
+// How many tile bytes follow the game_sim in a saved state
+internal int GetSavedTileCount(level *Level) {
+  return Level->IsInitialized ? GetBorderedTileCount(Level) : 0;
+}
+
+extern "C" GAME_SAVE_STATE(GameSaveState) {
+  game_state *State = GetGameState(Memory);
+  int TileCount = GetSavedTileCount(&State->Sim.Level);
+  int Size = (int)sizeof(game_sim) + TileCount;
+  if (Dest != NULL && MaxSize >= Size) {
+    memcpy(Dest, &State->Sim, sizeof(game_sim));
+    memcpy((u8 *)Dest + sizeof(game_sim), State->Tiles, TileCount);
+  }
+  return Size;
+}
+
+extern "C" GAME_LOAD_STATE(GameLoadState) {
+  if (Size < (int)sizeof(game_sim)) {
+    return false;
+  }
+  game_sim *Sim = (game_sim *)Source;
+  level *Level = &Sim->Level;
+  if (Level->Width < 0 || Level->Height < 0 ||
+      Size != (int)sizeof(game_sim) + GetSavedTileCount(Level)) {
+    return false;
+  }
+
+  game_state *State = GetGameState(Memory);
+  memcpy(&State->Sim, Source, sizeof(game_sim));
+  SetUpLevelArena(State);
+  memcpy(State->Tiles, (u8 *)Source + sizeof(game_sim),
+         GetSavedTileCount(&State->Sim.Level));
+  UpdateTilePlanes(State);
+  Memory->Stats = State->Sim.Stats;
+  Memory->StateHash = HashGameSim(&State->Sim, State->Tiles);
+
+  // Nothing on the screen is right anymore
+  State->Redraw.Screen = true;
+  State->Redraw.TileCount = 0;
+  State->UpdateScore = true;
+
+  return true;
 }
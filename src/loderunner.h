@@ -8,11 +8,14 @@
 #include "loderunner_platform.h"
 #include "loderunner_math.h"
 
-void *GameMemoryAlloc(int SizeInBytes);
+struct memory_arena;
+void *PushSize(memory_arena *Arena, int SizeInBytes);
+#define PushStruct(Arena, type) (type *)PushSize(Arena, (int)sizeof(type))
+#define PushArray(Arena, Count, type) \
+  (type *)PushSize(Arena, (Count) * (int)sizeof(type))
 
 struct game_offscreen_buffer {
   void *Memory;
-  int StartOffset;  // a byte offset specifying the top left corner
   int Width;
   int Height;
   int BytesPerPixel;
@@ -138,6 +141,33 @@ struct sprites {
   sprite Breaking;
 };
 
+// Where a character is in the atlas
+struct glyph {
+  bool32 Exists;
+  int XOffset;
+  int YOffset;
+  int Width;
+  int Height;
+  int Advance;  // how far to move after drawing it
+
+  // The part of the cell that isn't background, relative to the cell
+  int InkX;
+  int InkY;
+  int InkWidth;
+  int InkHeight;
+};
+
+#define MAX_TEXT_RUN_LENGTH 32
+
+// A string that's already on the screen. Drawing it again only draws
+// the characters that have changed since, until it's invalidated.
+struct text_run {
+  bool32 IsValid;
+  int X;
+  int Y;
+  char Text[MAX_TEXT_RUN_LENGTH];
+};
+
 struct file_read_result {
   void *Memory;
   u64 MemorySize;
@@ -177,7 +207,11 @@ struct game_input {
       player_input Player2;
     };
   };
-  r32 dtForFrame;
+  r32 dtForFrame;  // seconds since the last frame
+
+  // If not 0, run exactly this many ticks and ignore dtForFrame.
+  // Replays use it to run every frame the way it was recorded.
+  int TickCount;
 };
 
 struct frame {
@@ -186,15 +220,39 @@ struct frame {
   int Lasting;
 };
 
+// Animations are read-only and shared by everyone using them,
+// entities only remember where they are in each one
 struct animation {
-  int Counter = 0;
-  int FrameCount = 0;
-  int Frame = 0;  // Current frame
+  int FrameCount;
 
   // We assume we're not going to need more
   frame Frames[5];
 };
 
+struct animation_playback {
+  u8 Frame;  // Current frame
+  u8 Counter;
+};
+
+typedef enum {
+  PersonAnimation_GoingLeft,
+  PersonAnimation_GoingRight,
+  PersonAnimation_Climbing,
+  PersonAnimation_RopeLeft,
+  PersonAnimation_RopeRight,
+  PersonAnimation_Falling,
+  PersonAnimation_Blinking,
+
+  PersonAnimation_Count,
+} person_animation;
+
+typedef enum {
+  BrickAnimation_Breaking,
+  BrickAnimation_Restoring,
+
+  BrickAnimation_Count,
+} brick_animation;
+
 typedef enum {
   NOWHERE = 0,
   LEFT,
@@ -230,15 +288,9 @@ struct person : entity {
   int IsFalling;
   bool32 IsDead;
 
-  // Animation
-  animation *Animation;
-  animation GoingLeft;
-  animation GoingRight;
-  animation Climbing;
-  animation RopeLeft;
-  animation RopeRight;
-  animation Falling;
-  animation Blinking;
+  // Animation, from the player or the enemy set
+  person_animation Animation;
+  animation_playback Playback[PersonAnimation_Count];
 
   bool32 Animate;
   bool32 IsInitialized;
@@ -264,15 +316,20 @@ struct player : person {
 #define MAX_PATH_LENGTH 100
 
 struct enemy : person {
-  player *Pursuing;
+  int Pursuing;  // index into Level->Players, -1 when nobody yet
   int PathCooldown;
-  bool32 PathExists;
-  v2i Path[MAX_PATH_LENGTH];
-  int PathPointIndex;
-  int PathLength;
   int CarriesTreasure;
 };
 
+// Only touched when an enemy builds or follows a path, so it's kept
+// apart from the enemies to let the update loops go through them quickly
+struct enemy_path {
+  bool32 Exists;
+  int PointIndex;
+  int Length;
+  v2i Points[MAX_PATH_LENGTH];
+};
+
 struct treasure : entity {
   bool32 IsCollected;
 };
@@ -287,13 +344,9 @@ struct crushed_brick : entity {
     RESTORING,
   } State;
 
-  animation Breaking;
-  animation Restoring;
+  animation_playback Playback[BrickAnimation_Count];
 };
 
-#define MAX_LEVEL_HEIGHT 100
-#define MAX_LEVEL_WIDTH 100
-
 typedef enum {
   LVL_BLANK,
   LVL_BLANK_TMP,
@@ -309,14 +362,51 @@ typedef enum {
   LVL_INVALID,
 } tile_type;
 
+// What a tile is like, see kTileFlags
+enum tile_flag {
+  TileFlag_Solid = 0x01,      // people can't move into it
+  TileFlag_Climbable = 0x02,  // a ladder
+  TileFlag_Hangable = 0x04,   // a rope
+  TileFlag_Diggable = 0x08,
+  TileFlag_Supports = 0x10,  // falling treasure stops on top of it
+  TileFlag_Pathable = 0x20,  // enemies look for paths through it
+};
+const int kTileFlagCount = 6;
+
 typedef enum {
   WATERMAP_NOT_VISITED = 0,
   WATERMAP_OBSTACLE,
   WATERMAP_WATER,
 } water_point;
 
+// The part of the level that's on the screen
+struct viewport {
+  bool32 IsInitialized;
+
+  // Top left corner of the view in level pixels, follows the player
+  int CameraX;
+  int CameraY;
+  int Width;
+  int Height;
+
+  // Where the view is in the buffer
+  int ScreenX;
+  int ScreenY;
+};
+
 const int kCrushedBrickCount = 30;
+const int kMaxPlayerCount = 2;
 const int kMaxRespawnCount = 10;
+const int kLevelCount = 14;  // the last one is the you win screen
+const int kPlayableLevelCount = kLevelCount - 1;
+
+// Levels are sized to fit, this is as big as a level given in
+// game_memory::LevelText can get. Whether the level arena holds it
+// depends on its shape too, see GetLevelArenaSize.
+const int kMaxLevelTileCount = 1024 * 1024;
+
+const int kMaxEnemyCount = 16;
+const int kMaxTreasureCount = 128;
 
 struct level {
   bool32 IsInitialized;
@@ -327,33 +417,52 @@ struct level {
   int DrawTilesPerFrame;
 
   bool32 IsDisappearing;
-  animation Disappearing;
+  animation_playback Disappearing;
 
   int Width;  // in tiles
   int Height;
 
+  viewport Viewport;
+
   int PlayerCount;
-  player Players[2];
+  player Players[kMaxPlayerCount];
 
   int EnemyCount;
-  enemy *Enemies;
+  enemy Enemies[kMaxEnemyCount];
+  enemy_path EnemyPaths[kMaxEnemyCount];  // one for each enemy
 
   int TreasureCount;
-  treasure *Treasures;
+  treasure Treasures[kMaxTreasureCount];
   int TreasuresCollected;
   bool32 AllTreasuresCollected;
 
-  tile_type Contents[MAX_LEVEL_HEIGHT][MAX_LEVEL_WIDTH];
-  water_point WaterMap[MAX_LEVEL_HEIGHT][MAX_LEVEL_WIDTH];
-  int DirectionMap[MAX_LEVEL_HEIGHT][MAX_LEVEL_WIDTH];
-
   crushed_brick CrushedBricks[kCrushedBrickCount];
   int NextCrushedBrickAvailable;
 
   int RespawnCount;
   v2i Respawns[kMaxRespawnCount];
+
+  // Seeded when the level is loaded, everything random in it comes from here
+  random_series Random;
+};
+
+#define MAX_DIRTY_TILE_COUNT 4096
+
+// What the simulation has changed since the game was last rendered,
+// however many ticks ago that was
+struct redraw_state {
+  bool32 Screen;  // start over from an empty screen
+  bool32 View;    // all the visible tiles
+  bool32 Footer;
+  int TileCount;
+  v2i Tiles[MAX_DIRTY_TILE_COUNT];
 };
 
+// The game always advances in ticks of the same length, as many
+// of them per frame as the time since the last frame is worth
+const int kTicksPerSecond = 60;
+const int kMaxTicksPerFrame = 8;  // slow down if we fall further behind
+
 // -----------------------------------------------------------
 // Platform functions
 
@@ -365,19 +474,255 @@ typedef DEBUG_PLATFORM_READ_ENTIRE_FILE(debug_platform_read_entire_file);
   void name(char *Filename, int FileSize, void *Memory)
 typedef DEBUG_PLATFORM_WRITE_ENTIRE_FILE(debug_platform_write_entire_file);
 
+#if BUILD_INTERNAL
+enum {
+  DebugCycleCounter_GameUpdateAndRender,
+  DebugCycleCounter_SortRenderEntries,
+  DebugCycleCounter_RenderGroupToOutput,
+  DebugCycleCounter_UpscaleToOutput,
+  DebugCycleCounter_Count,
+};
+
+struct debug_cycle_counter {
+  u64 CycleCount;
+  u32 HitCount;
+};
+#endif
+
+struct platform_work_queue;
+
+#define PLATFORM_WORK_QUEUE_CALLBACK(name) \
+  void name(platform_work_queue *Queue, void *Data)
+typedef PLATFORM_WORK_QUEUE_CALLBACK(platform_work_queue_callback);
+
+#define PLATFORM_ADD_ENTRY(name)                  \
+  void name(platform_work_queue *Queue,           \
+            platform_work_queue_callback *Callback, void *Data)
+typedef PLATFORM_ADD_ENTRY(platform_add_entry);
+
+#define PLATFORM_COMPLETE_ALL_WORK(name) void name(platform_work_queue *Queue)
+typedef PLATFORM_COMPLETE_ALL_WORK(platform_complete_all_work);
+
+// Makes Size bytes from Start on usable, before that they're only reserved.
+// Hot memory is gone through all the time, huge pages suit it best.
+#define PLATFORM_COMMIT_MEMORY(name) \
+  bool32 name(void *Start, int Size, bool32 IsHot)
+typedef PLATFORM_COMMIT_MEMORY(platform_commit_memory);
+
+// What happened in the game so far, for the platform to report
+struct game_stats {
+  u64 Ticks;
+  int Deaths;
+  u64 FirstDeathTick;  // valid once there are deaths
+  int LevelsCompleted;
+  int TreasuresCollected;  // by the players
+};
+
+// A part of the game memory that's handed out front to back and only
+// ever freed all at once
+struct memory_arena {
+  u8 *Base;
+  int Size;
+  int Used;
+  int HighWater;  // the most it has had in use at once
+
+  // Only as much as it has needed is committed, if it's up to the game
+  int Committed;
+  bool32 IsHot;
+  platform_commit_memory *Commit;
+};
+
+// Arenas start on a huge page, and hot ones are committed a huge page
+// at a time so that they can get them. Others commit less at once.
+const int kArenaAlignment = 2 * 1024 * 1024;
+const int kCommitGranularity = 64 * 1024;
+
+// The game's arenas, by how long what's in them lives
+enum game_arena {
+  GameArena_Permanent,  // assets and the like, never freed
+  GameArena_Level,      // freed when a level is loaded, hot
+  GameArena_Frame,      // freed at the start of every frame, hot
+
+  GameArena_Count
+};
+
+const char *const kGameArenaNames[GameArena_Count] = {"permanent", "level",
+                                                      "frame"};
+
+// At most what SetUpLevelArena pushes for a level this size, PushSize
+// rounds every push up by as much as 15 bytes
+inline i64 GetLevelArenaSize(int Width, int Height) {
+  i64 TileCount = (i64)Width * Height;
+  i64 BorderedCount = (i64)(Width + 2) * (Height + 2);
+  i64 PlaneSize = (i64)((Width + 2 + 63) / 64) * (Height + 2) * sizeof(u64);
+
+  i64 Result = BorderedCount + 15 + 15;  // tiles
+  Result += BorderedCount * sizeof(water_point) + 15;
+  Result += TileCount * sizeof(int) + 15;  // directions
+  Result += (1 + kTileFlagCount) * (PlaneSize + 15);  // sideways and flags
+  return Result;
+}
+
+// The sprites are downsampled by keeping one pixel out of Scale, so the
+// scale has to divide every size and offset in the atlas. The cursor
+// corners are only 2 pixel aligned, the strokes of the glyphs 4.
+inline bool32 IsValidRenderScale(int Scale) {
+  return Scale == 1 || Scale == 2;
+}
+
 struct game_memory {
   int MemorySize;
   bool32 IsInitialized;
   void *Start;
-  void *Free;
+  void *Free;  // the game state ends here, the arenas come after it
+
+  // If it's NULL all of the memory is usable from the start. Otherwise
+  // it's only reserved and the game commits what it needs as it goes.
+  // Start has to be kArenaAlignment aligned for hot arenas to get huge
+  // pages.
+  platform_commit_memory *PlatformCommitMemory;
+
+  // Rendering is split between the threads of this queue.
+  // If it's NULL everything is drawn on the calling thread.
+  platform_work_queue *RenderQueue;
+  platform_add_entry *PlatformAddEntry;
+  platform_complete_all_work *PlatformCompleteAllWork;
+
+  // The game draws at a lower resolution and scales it up to the buffer,
+  // this is how many buffer pixels one game pixel takes. 0 is the default,
+  // otherwise see IsValidRenderScale.
+  int RenderScale;
+
+  // Where a new game starts, wraps around the level count
+  int StartLevel;
+
+  // If not NULL, played instead of every built-in level. Written like
+  // the ones in LEVELS, at most kMaxLevelTileCount tiles. If the level
+  // arena can't hold it the built-in level is played after all, see
+  // GetLevelArenaShare.
+  char const *LevelText;
+
+  // The same seed and input always play out the same way
+  u64 RandomSeed;
+
+  // Kept up to date by the game
+  game_stats Stats;
+
+  // Of the simulation after the last tick, two runs of the same
+  // replay have to agree on it
+  u64 StateHash;
+
+  // Copies of the game's arenas, updated after every frame
+  memory_arena Arenas[GameArena_Count];
 
   // Debug functions
   debug_platform_read_entire_file *DEBUGPlatformReadEntireFile;
   debug_platform_write_entire_file *DEBUGPlatformWriteEntireFile;
+
+#if BUILD_INTERNAL
+  // Accumulated by the game, reported and reset by the platform
+  debug_cycle_counter Counters[DebugCycleCounter_Count];
+#endif
+};
+
+#if BUILD_INTERNAL
+// Per thread, since several games can run at once on different threads
+extern thread_local game_memory *DebugGlobalMemory;
+#define BEGIN_TIMED_BLOCK(ID) u64 StartCycleCount##ID = ReadCycleCounter();
+#define END_TIMED_BLOCK(ID)                                          \
+  DebugGlobalMemory->Counters[DebugCycleCounter_##ID].CycleCount += \
+      ReadCycleCounter() - StartCycleCount##ID;                      \
+  ++DebugGlobalMemory->Counters[DebugCycleCounter_##ID].HitCount;
+#else
+#define BEGIN_TIMED_BLOCK(ID)
+#define END_TIMED_BLOCK(ID)
+#endif
+
+struct render_group;
+
+// Everything that decides what happens next, but the tiles. There are no
+// pointers in it, so a memcpy of it followed by the tiles is a complete
+// snapshot of the game that can be restored into any game memory.
+struct game_sim {
+  bool32 IsFinished;  // all levels completed
+
+  bool32 Clock;
+  int DeadWait;
+  bool32 ShowMenu;
+  int SelectedLevel;
+  int MenuKeyPressCooldown;
+
+  level Level;
+  int LevelLoadCount;  // each attempt at a level gets its own random stream
+  i32 Score;
+  r32 PendingTicks;  // of game time not simulated yet
+  bool32 Debug;
+
+  game_stats Stats;  // copied to game_memory::Stats after every frame
 };
 
+// Everything the game keeps between calls. It lives at the start of
+// the game memory, so two game memories are two independent games.
+struct game_state {
+  bool32 IsInitialized;
+  game_memory *Memory;
+  game_offscreen_buffer *BackBuffer;  // the one passed in this frame
+
+  game_sim Sim;
+
+  memory_arena Arenas[GameArena_Count];
+
+  // A tile_type byte per tile of the level, row by row, with a border of
+  // LVL_INVALID all around so that whatever is next to a tile of the level
+  // can be looked at without checking the bounds. Sized to the level and
+  // kept in the level arena, see TileIndex.
+  u8 *Tiles;
+
+  // Scratch for FindPath from the level arena, filled in again every time
+  // it runs. WaterMap is laid out like Tiles, border and all, the
+  // DirectionMap has a tile each.
+  water_point *WaterMap;
+  int *DirectionMap;
+  u64 *SidewaysPlane;  // where an enemy can go left or right to
+
+  // A bit plane for each tile_flag, from the level arena and kept up to
+  // date with the tiles. Rows are laid out like Tiles, border and all,
+  // tile Col of row Row is bit Col + 1.
+  int TilePlaneStride;  // in words
+  u64 *TilePlanes[kTileFlagCount];
+
+  game_sound Sound;
+  platform_sound_output *SoundOutput;
+
+  render_group *RenderGroup;
+  bmp_file *Image;
+
+  // What the game actually draws into, scaled up to the backbuffer
+  game_offscreen_buffer NativeBuffer;
+  bmp_file *NativeImage;
+  int RenderScale;
+
+  glyph Glyphs[128];
+  bool32 GlyphsInitialized;
+  bool32 UpdateScore;
+  text_run ScoreRun;
+  redraw_state Redraw;
+};
+
+// Whatever's left of a game memory after the state, the level arena
+// gets a quarter of it, see GetGameState
+inline int GetLevelArenaShare(int MemorySize) {
+  int Alignment = kArenaAlignment;
+  int StateSize =
+      ((int)sizeof(game_state) + Alignment - 1) & ~(Alignment - 1);
+  int Size = MemorySize - StateSize;
+  return (Size / 4) & ~(Alignment - 1);
+}
+
 // Game functions
 
+// Buffer can be NULL to only run the simulation
+
 #define GAME_UPDATE_AND_RENDER(name)                                \
   int name(game_input *NewInput, game_offscreen_buffer *Buffer,     \
            game_memory *Memory, platform_sound_output *SoundOutput, \
@@ -388,4 +733,19 @@ GAME_UPDATE_AND_RENDER(GameUpdateAndRenderStub) {
   return 0;
 }
 
+// A snapshot of the game_sim and the tiles. It has no pointers in it, so it
+// can be saved to a file and loaded into another game memory by another
+// process. Its size follows the size of the level.
+//
+// Returns how many bytes the state takes, and only writes it to Dest
+// if MaxSize is at least that
+#define GAME_SAVE_STATE(name) \
+  int name(game_memory *Memory, void *Dest, int MaxSize)
+typedef GAME_SAVE_STATE(game_save_state);
+
+// Returns false if Source isn't a state saved by this version of the game
+#define GAME_LOAD_STATE(name) \
+  bool32 name(game_memory *Memory, void *Source, int Size)
+typedef GAME_LOAD_STATE(game_load_state);
+
 #endif  // LODERUNNER_H
\ No newline at end of file
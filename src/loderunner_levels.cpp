@@ -1,7 +1,5 @@
 #include "loderunner.h"
 
-const int kLevelCount = 14;  // the last one is the you win screen
-
 const char *LEVELS[kLevelCount] = {
 
     "      r          r       | r      \n"
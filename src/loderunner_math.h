@@ -4,22 +4,40 @@
 #include <math.h>
 #include <stdlib.h>
 
-int randint(int n) {
-  // Copied from StackOverflow
-  if ((n - 1) == RAND_MAX) {
-    return rand();
-  } else {
-    // Chop off all of the values that would cause skew...
-    long end = RAND_MAX / n;  // truncate skew
-    Assert(end > 0L);
-    end *= n;
-
-    int r;
-    while ((r = rand()) >= end)
-      ;
-
-    return r % n;
-  }
+// PCG32 (pcg-random.org). Small and fast, each game owns its own
+// so that games don't disturb each other and can be replayed.
+struct random_series {
+  u64 State;
+  u64 Increment;  // selects the stream, always odd
+};
+
+inline u32 RandomNextU32(random_series *Series) {
+  u64 OldState = Series->State;
+  Series->State = OldState * 6364136223846793005ull + Series->Increment;
+  u32 XorShifted = (u32)(((OldState >> 18u) ^ OldState) >> 27u);
+  u32 Rotation = (u32)(OldState >> 59u);
+  return (XorShifted >> Rotation) | (XorShifted << ((0u - Rotation) & 31));
+}
+
+inline random_series RandomSeed(u64 Seed, u64 Stream) {
+  random_series Result = {};
+  Result.Increment = (Stream << 1u) | 1u;
+  RandomNextU32(&Result);
+  Result.State += Seed;
+  RandomNextU32(&Result);
+  return Result;
+}
+
+// From 0 to Count - 1, without the modulo bias
+inline int RandomChoice(random_series *Series, int Count) {
+  Assert(Count > 0);
+  u32 Range = (u32)Count;
+  u32 Threshold = (0u - Range) % Range;
+  u32 Value;
+  do {
+    Value = RandomNextU32(Series);
+  } while (Value < Threshold);
+  return (int)(Value % Range);
 }
 
 union v2 {
@@ -195,6 +213,15 @@ inline int Abs(int Value) {
     return -Value;
 }
 
+// Rounds towards negative infinity, Denominator must be positive
+inline int FloorDiv(int Numerator, int Denominator) {
+  int Result = Numerator / Denominator;
+  if (Numerator % Denominator < 0) {
+    Result -= 1;
+  }
+  return Result;
+}
+
 inline r32 V2Length(v2 Vector) {
   r32 Result = SquareRoot(Square(Vector.x) + Square(Vector.y));
   return Result;
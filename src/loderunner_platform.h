@@ -33,6 +33,20 @@ typedef i32 bool32;
 #define breakpoint
 #endif
 
+#if BUILD_INTERNAL
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define ReadCycleCounter() __rdtsc()
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define ReadCycleCounter() __rdtsc()
+#else
+#define ReadCycleCounter() 0
+#endif
+#endif
+
+#define InvalidCodePath Assert(!"InvalidCodePath")
+
 #define COUNT_OF(x) \
   ((sizeof(x) / sizeof(0 [x])) / ((size_t)(!(sizeof(x) % sizeof(0 [x])))))
 
@@ -0,0 +1,643 @@
+#include "loderunner_render.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RENDER_SSE2 1
+#else
+#define RENDER_SSE2 0
+#endif
+
+inline u8 UnmaskColor(u32 Pixel, u32 ColorMask) {
+  int BitOffset = 0;
+  switch (ColorMask) {
+    case 0x000000FF:
+      BitOffset = 0;
+      break;
+    case 0x0000FF00:
+      BitOffset = 8;
+      break;
+    case 0x00FF0000:
+      BitOffset = 16;
+      break;
+    case 0xFF000000:
+      BitOffset = 24;
+      break;
+  }
+
+  return (u8)((Pixel & ColorMask) >> BitOffset);
+}
+
+inline rect IntersectRects(rect A, rect B) {
+  rect Result;
+
+  Result.Top = (A.Top > B.Top) ? A.Top : B.Top;
+  Result.Bottom = (A.Bottom < B.Bottom) ? A.Bottom : B.Bottom;
+  Result.Left = (A.Left > B.Left) ? A.Left : B.Left;
+  Result.Right = (A.Right < B.Right) ? A.Right : B.Right;
+
+  return Result;
+}
+
+inline bool32 RectIsEmpty(rect Rect) {
+  bool32 Result = (Rect.Left >= Rect.Right || Rect.Top >= Rect.Bottom);
+  return Result;
+}
+
+// The smallest rect that has both, empty ones don't count
+inline rect UnionRects(rect A, rect B) {
+  if (RectIsEmpty(A)) return B;
+  if (RectIsEmpty(B)) return A;
+
+  rect Result;
+
+  Result.Top = (A.Top < B.Top) ? A.Top : B.Top;
+  Result.Bottom = (A.Bottom > B.Bottom) ? A.Bottom : B.Bottom;
+  Result.Left = (A.Left < B.Left) ? A.Left : B.Left;
+  Result.Right = (A.Right > B.Right) ? A.Right : B.Right;
+
+  return Result;
+}
+
+// X and Y are in buffer pixels, nothing is drawn outside ClipRect
+internal void RenderRectangle(game_offscreen_buffer *Buffer, rect ClipRect,
+                              int X, int Y, int Width, int Height,
+                              u32 Color) {
+  rect Rect = {Y, Y + Height, X, X + Width};
+  Rect = IntersectRects(Rect, ClipRect);
+  if (RectIsEmpty(Rect)) return;
+
+  int Pitch = Buffer->Width * Buffer->BytesPerPixel;
+  u8 *Row = (u8 *)Buffer->Memory + Pitch * Rect.Top +
+            Rect.Left * Buffer->BytesPerPixel;
+
+  for (int pY = Rect.Top; pY < Rect.Bottom; pY++) {
+    u32 *Pixel = (u32 *)Row;
+    for (int pX = Rect.Left; pX < Rect.Right; pX++) {
+      *Pixel++ = Color;
+    }
+    Row += Pitch;
+  }
+}
+
+// If Width is bigger than SrcWidth the sprite is repeated horizontally
+internal void RenderSprite(game_offscreen_buffer *Buffer, rect ClipRect,
+                           bmp_file *Image, int X, int Y, int Width,
+                           int Height, int XOffset, int YOffset,
+                           int SrcWidth) {
+  rect Rect = {Y, Y + Height, X, X + Width};
+  Rect = IntersectRects(Rect, ClipRect);
+  if (RectIsEmpty(Rect)) return;
+
+  // Skip the clipped part of the sprite
+  int StartSrcX = (Rect.Left - X) % SrcWidth;
+  YOffset += Rect.Top - Y;
+
+  int Pitch = Buffer->Width * Buffer->BytesPerPixel;
+  int SrcPitch = Image->Width;
+
+  u8 *Row = (u8 *)Buffer->Memory + Pitch * Rect.Top +
+            Rect.Left * Buffer->BytesPerPixel;
+  u32 *BottomLeftCorner =
+      (u32 *)Image->Bitmap + Image->Width * (Image->Height - 1);
+  u32 *SrcRow = BottomLeftCorner - SrcPitch * YOffset + XOffset;
+
+  for (int pY = Rect.Top; pY < Rect.Bottom; pY++) {
+    u32 *Pixel = (u32 *)Row;
+    u32 *SrcPixel = SrcRow + StartSrcX;
+    int SrcX = StartSrcX;
+
+    for (int pX = Rect.Left; pX < Rect.Right; pX++) {
+      u8 Red = UnmaskColor(*SrcPixel, Image->RedMask);
+      u8 Green = UnmaskColor(*SrcPixel, Image->GreenMask);
+      u8 Blue = UnmaskColor(*SrcPixel, Image->BlueMask);
+      u8 Alpha = UnmaskColor(*SrcPixel, Image->AlphaMask);
+
+      u32 ResultingColor = Red << 16 | Green << 8 | Blue;
+
+      if (Alpha > 0 && Alpha < 0xFF) {
+        r32 ExistingRed = (r32)((*Pixel >> 16) & 0xFF);
+        r32 ExistingGreen = (r32)((*Pixel >> 8) & 0xFF);
+        r32 ExistingBlue = (r32)((*Pixel >> 0) & 0xFF);
+
+        r32 NewRed = (r32)((ResultingColor >> 16) & 0xFF);
+        r32 NewGreen = (r32)((ResultingColor >> 8) & 0xFF);
+        r32 NewBlue = (r32)((ResultingColor >> 0) & 0xFF);
+
+        // Blending
+        r32 t = (r32)Alpha / 255.0f;
+
+        NewRed = NewRed * t + ExistingRed * (1 - t);
+        NewGreen = NewGreen * t + ExistingGreen * (1 - t);
+        NewBlue = NewBlue * t + ExistingBlue * (1 - t);
+
+        *Pixel =
+            (((u8)NewRed << 16) | ((u8)NewGreen << 8) | ((u8)NewBlue << 0));
+      } else if (Alpha == 0xFF) {
+        *Pixel = ResultingColor;
+      } else {
+        // do nothing
+      }
+
+      Pixel++;
+      SrcPixel++;
+      if (++SrcX == SrcWidth) {
+        SrcX = 0;
+        SrcPixel = SrcRow;
+      }
+    }
+    Row += Pitch;
+    SrcRow -= SrcPitch;
+  }
+}
+
+// Point samples the atlas so that sprite offsets can just be divided by Scale
+internal bmp_file *DownsampleImage(memory_arena *Arena, bmp_file *Image,
+                                   int Scale) {
+  bmp_file *Result = PushStruct(Arena, bmp_file);
+  *Result = *Image;
+  Result->Width = Image->Width / Scale;
+  Result->Height = Image->Height / Scale;
+  Result->Bitmap = PushArray(Arena, Result->Width * Result->Height, u32);
+
+  // Rows go bottom up, keep the top ones
+  for (int Y = 0; Y < Result->Height; Y++) {
+    u32 *Dest = (u32 *)Result->Bitmap + Result->Width * (Result->Height - 1 - Y);
+    u32 *Source =
+        (u32 *)Image->Bitmap + Image->Width * (Image->Height - 1 - Y * Scale);
+    for (int X = 0; X < Result->Width; X++) {
+      Dest[X] = Source[X * Scale];
+    }
+  }
+
+  return Result;
+}
+
+// Writes Scale rows of the destination for every source row in the range.
+// The last band also fills the rows below the scaled image.
+internal void UpscaleRows(upscale_work *Work) {
+  game_offscreen_buffer *Source = Work->Source;
+  game_offscreen_buffer *Dest = Work->Dest;
+  int Scale = Work->Scale;
+
+  int SourcePitch = Source->Width;
+  int DestPitch = Dest->Width;
+  int ScaledWidth = Source->Width * Scale;
+  int ScaledBytes = ScaledWidth * (int)sizeof(u32);
+
+  for (int Y = Work->FirstRow; Y < Work->EndRow; Y++) {
+    u32 *SourceRow = (u32 *)Source->Memory + SourcePitch * Y;
+    u32 *DestRow = (u32 *)Dest->Memory + DestPitch * Y * Scale;
+    int X = 0;
+
+    if (Scale == 1) {
+      memcpy(DestRow, SourceRow, ScaledBytes);
+      X = Source->Width;
+    }
+#if RENDER_SSE2
+    else if (Scale == 2) {
+      for (; X + 4 <= Source->Width; X += 4) {
+        __m128i Pixels = _mm_loadu_si128((__m128i *)(SourceRow + X));
+        __m128i Low = _mm_unpacklo_epi32(Pixels, Pixels);
+        __m128i High = _mm_unpackhi_epi32(Pixels, Pixels);
+        _mm_storeu_si128((__m128i *)(DestRow + 2 * X), Low);
+        _mm_storeu_si128((__m128i *)(DestRow + 2 * X + 4), High);
+      }
+    }
+#endif
+
+    // Whatever is left over or couldn't be done with SIMD
+    for (; X < Source->Width; X++) {
+      u32 Pixel = SourceRow[X];
+      for (int i = 0; i < Scale; i++) {
+        DestRow[X * Scale + i] = Pixel;
+      }
+    }
+    for (int pX = ScaledWidth; pX < Dest->Width; pX++) {
+      DestRow[pX] = Work->BorderColor;
+    }
+
+    // The other rows are the same
+    for (int i = 1; i < Scale; i++) {
+      memcpy(DestRow + DestPitch * i, DestRow, Dest->Width * sizeof(u32));
+    }
+  }
+
+  if (Work->EndRow == Source->Height) {
+    for (int pY = Source->Height * Scale; pY < Dest->Height; pY++) {
+      u32 *DestRow = (u32 *)Dest->Memory + DestPitch * pY;
+      for (int pX = 0; pX < Dest->Width; pX++) {
+        DestRow[pX] = Work->BorderColor;
+      }
+    }
+  }
+}
+
+internal PLATFORM_WORK_QUEUE_CALLBACK(DoUpscaleWork) {
+  upscale_work *Work = (upscale_work *)Data;
+
+  UpscaleRows(Work);
+}
+
+// Nearest neighbour, Dest must be at least Scale times bigger than Source
+internal void UpscaleToOutput(game_memory *Memory,
+                              game_offscreen_buffer *Source,
+                              game_offscreen_buffer *Dest, int Scale,
+                              u32 BorderColor) {
+  Assert(Source->Width * Scale <= Dest->Width);
+  Assert(Source->Height * Scale <= Dest->Height);
+
+  BEGIN_TIMED_BLOCK(UpscaleToOutput);
+
+  upscale_work Work[kRenderBandCount];
+  int BandCount = (Memory->RenderQueue == NULL) ? 1 : kRenderBandCount;
+  int BandHeight = (Source->Height + BandCount - 1) / BandCount;
+
+  for (int Band = 0; Band < BandCount; Band++) {
+    upscale_work *BandWork = &Work[Band];
+    BandWork->Source = Source;
+    BandWork->Dest = Dest;
+    BandWork->Scale = Scale;
+    BandWork->BorderColor = BorderColor;
+    BandWork->FirstRow = Band * BandHeight;
+    BandWork->EndRow = BandWork->FirstRow + BandHeight;
+    if (BandWork->EndRow >= Source->Height) {
+      BandWork->EndRow = Source->Height;
+    }
+
+    if (Memory->RenderQueue == NULL) {
+      UpscaleRows(BandWork);
+    } else {
+      Memory->PlatformAddEntry(Memory->RenderQueue, DoUpscaleWork, BandWork);
+    }
+
+    if (BandWork->EndRow == Source->Height) break;
+  }
+
+  if (Memory->RenderQueue != NULL) {
+    Memory->PlatformCompleteAllWork(Memory->RenderQueue);
+  }
+
+  END_TIMED_BLOCK(UpscaleToOutput);
+}
+
+internal void RenderGroupToOutput(render_group *Group,
+                                  game_offscreen_buffer *Buffer,
+                                  rect ClipRect) {
+  for (int i = 0; i < Group->OutputEntryCount; i++) {
+    render_entry *Entry = &Group->OutputEntries[i];
+    rect EntryClipRect =
+        IntersectRects(ClipRect, Group->ClipRects[Entry->ClipRectIndex]);
+
+    switch (Entry->Type) {
+      case RenderEntry_Clear: {
+        RenderRectangle(Buffer, EntryClipRect, 0, 0, Buffer->Width,
+                        Buffer->Height, Entry->Color);
+      } break;
+
+      case RenderEntry_Rectangle: {
+        RenderRectangle(Buffer, EntryClipRect, Entry->X, Entry->Y,
+                        Entry->Width, Entry->Height, Entry->Color);
+      } break;
+
+      case RenderEntry_Sprite: {
+        RenderSprite(Buffer, EntryClipRect, Group->Image, Entry->X, Entry->Y,
+                     Entry->Width, Entry->Height, Entry->XOffset,
+                     Entry->YOffset, Entry->SrcWidth);
+      } break;
+
+      case RenderEntry_Tile: {
+        InvalidCodePath;
+      } break;
+    }
+  }
+}
+
+inline u64 GetSortKey(render_entry *Entry) {
+  // Layer | atlas row | atlas column | tile row | tile column
+  u64 AtlasY = 0x3FF;  // not reading the atlas, goes after the sprites
+  u64 AtlasX = 0x3FF;
+  if (Entry->Type == RenderEntry_Sprite) {
+    AtlasY = (u64)Entry->YOffset & 0x3FF;
+    AtlasX = (u64)Entry->XOffset & 0x3FF;
+  }
+
+  u64 Key = ((u64)Entry->Layer << 56) | (AtlasY << 46) | (AtlasX << 36);
+  if (Entry->IsTile) {
+    Key |= (((u64)Entry->Row & 0x3FFFF) << 18) | ((u64)Entry->Col & 0x3FFFF);
+  }
+
+  return Key;
+}
+
+// Stable, so entries with equal keys are drawn in the order they were pushed
+internal void MergeSort(int Count, sort_entry *First, sort_entry *Temp) {
+  sort_entry *Source = First;
+  sort_entry *Dest = Temp;
+
+  for (int Width = 1; Width < Count; Width *= 2) {
+    for (int Start = 0; Start < Count; Start += 2 * Width) {
+      int Middle = (Start + Width < Count) ? Start + Width : Count;
+      int End = (Start + 2 * Width < Count) ? Start + 2 * Width : Count;
+
+      int Half0 = Start;
+      int Half1 = Middle;
+      for (int Out = Start; Out < End; Out++) {
+        if (Half1 >= End ||
+            (Half0 < Middle && Source[Half0].Key <= Source[Half1].Key)) {
+          Dest[Out] = Source[Half0++];
+        } else {
+          Dest[Out] = Source[Half1++];
+        }
+      }
+    }
+
+    sort_entry *Swap = Source;
+    Source = Dest;
+    Dest = Swap;
+  }
+
+  if (Source != First) {
+    memcpy(First, Source, Count * sizeof(sort_entry));
+  }
+}
+
+inline bool32 CanMergeTiles(render_entry *Run, render_entry *Entry) {
+  if (!Run->IsTile || !Entry->IsTile) return false;
+
+  int RunLength = Run->Width / Run->SrcWidth;
+  bool32 Result = Run->Type == Entry->Type &&
+                  Run->Layer == Entry->Layer &&
+                  Run->ClipRectIndex == Entry->ClipRectIndex &&
+                  Run->Row == Entry->Row &&
+                  Run->Col + RunLength == Entry->Col &&
+                  Run->Height == Entry->Height;
+  if (Result && Entry->Type == RenderEntry_Sprite) {
+    Result = Run->XOffset == Entry->XOffset && Run->YOffset == Entry->YOffset &&
+             Run->SrcWidth == Entry->Width;
+  } else if (Result) {
+    Result = Run->Color == Entry->Color;
+  }
+
+  return Result;
+}
+
+internal void PrepareOutputEntries(render_group *Group) {
+  // Tiles become sprites or rectangles
+  for (int i = 0; i < Group->EntryCount; i++) {
+    render_entry *Entry = &Group->Entries[i];
+    if (Entry->Type == RenderEntry_Tile) {
+      Group->ResolveTile(Group->ResolveTileContext, Entry);
+      Assert(Entry->Type != RenderEntry_Tile);
+      Entry->XOffset /= Group->Scale;
+      Entry->YOffset /= Group->Scale;
+    }
+    Entry->SrcWidth = Entry->Width;
+  }
+
+  if (!Group->SortEntries) {
+    Group->OutputEntries = Group->Entries;
+    Group->OutputEntryCount = Group->EntryCount;
+    return;
+  }
+
+  BEGIN_TIMED_BLOCK(SortRenderEntries);
+
+  sort_entry *Sorted = Group->SortEntries0;
+  for (int i = 0; i < Group->EntryCount; i++) {
+    Sorted[i].Key = GetSortKey(&Group->Entries[i]);
+    Sorted[i].Index = i;
+  }
+  MergeSort(Group->EntryCount, Sorted, Group->SortEntries1);
+
+  Group->OutputEntries = Group->SortedEntries;
+  Group->OutputEntryCount = 0;
+  render_entry *Last = NULL;
+  render_entry *Previous = NULL;
+
+  for (int i = 0; i < Group->EntryCount; i++) {
+    render_entry *Entry = &Group->Entries[Sorted[i].Index];
+
+    // The same tile pushed several times looks the same every time
+    if (Previous && Entry->IsTile && Previous->IsTile &&
+        Entry->Col == Previous->Col && Entry->Row == Previous->Row &&
+        Entry->X == Previous->X && Entry->Y == Previous->Y &&
+        Entry->ClipRectIndex == Previous->ClipRectIndex) {
+      continue;
+    }
+    Previous = Entry;
+
+    if (Last && Group->MergeTileRuns && CanMergeTiles(Last, Entry)) {
+      Last->Width += Entry->Width;
+    } else {
+      Last = &Group->OutputEntries[Group->OutputEntryCount++];
+      *Last = *Entry;
+    }
+  }
+
+  END_TIMED_BLOCK(SortRenderEntries);
+}
+
+internal PLATFORM_WORK_QUEUE_CALLBACK(DoBandRenderWork) {
+  band_render_work *Work = (band_render_work *)Data;
+
+  RenderGroupToOutput(Work->Group, Work->Buffer, Work->ClipRect);
+}
+
+internal void TiledRenderGroupToOutput(render_group *Group,
+                                       game_offscreen_buffer *Buffer) {
+  game_memory *Memory = Group->Memory;
+  rect BufferRect = {0, Buffer->Height, 0, Buffer->Width};
+
+  PrepareOutputEntries(Group);
+
+  BEGIN_TIMED_BLOCK(RenderGroupToOutput);
+
+  if (Memory->RenderQueue == NULL) {
+    RenderGroupToOutput(Group, Buffer, BufferRect);
+    END_TIMED_BLOCK(RenderGroupToOutput);
+    return;
+  }
+
+  band_render_work Work[kRenderBandCount];
+  int BandHeight = (Buffer->Height + kRenderBandCount - 1) / kRenderBandCount;
+
+  for (int Band = 0; Band < kRenderBandCount; Band++) {
+    rect ClipRect = BufferRect;
+    ClipRect.Top = Band * BandHeight;
+    ClipRect.Bottom = ClipRect.Top + BandHeight;
+    if (ClipRect.Bottom > Buffer->Height) {
+      ClipRect.Bottom = Buffer->Height;
+    }
+    if (RectIsEmpty(ClipRect)) break;
+
+    band_render_work *BandWork = &Work[Band];
+    BandWork->Group = Group;
+    BandWork->Buffer = Buffer;
+    BandWork->ClipRect = ClipRect;
+
+    Memory->PlatformAddEntry(Memory->RenderQueue, DoBandRenderWork, BandWork);
+  }
+
+  Memory->PlatformCompleteAllWork(Memory->RenderQueue);
+
+  END_TIMED_BLOCK(RenderGroupToOutput);
+}
+
+// Everything in it only lives for as long as Arena does, usually a frame
+internal render_group *AllocateRenderGroup(memory_arena *Arena,
+                                           int MaxEntryCount,
+                                           resolve_tile *ResolveTile,
+                                           void *ResolveTileContext) {
+  render_group *Group = PushStruct(Arena, render_group);
+  *Group = {};
+  Group->MaxEntryCount = MaxEntryCount;
+  Group->Entries = PushArray(Arena, MaxEntryCount, render_entry);
+  Group->SortedEntries = PushArray(Arena, MaxEntryCount, render_entry);
+  Group->SortEntries0 = PushArray(Arena, MaxEntryCount, sort_entry);
+  Group->SortEntries1 = PushArray(Arena, MaxEntryCount, sort_entry);
+  Group->ResolveTile = ResolveTile;
+  Group->ResolveTileContext = ResolveTileContext;
+
+  Group->SortEntries = true;
+  Group->MergeTileRuns = true;
+
+  return Group;
+}
+
+// Buffer and Image are native, Scale times smaller than what the game uses
+internal void BeginRender(render_group *Group, game_memory *Memory,
+                          game_offscreen_buffer *Buffer, bmp_file *Image,
+                          int Scale) {
+  Group->Memory = Memory;
+  Group->Buffer = Buffer;
+  Group->Image = Image;
+  Group->Scale = Scale;
+  Group->EntryCount = 0;
+  Group->CurrentLayer = RenderLayer_Background;
+
+  Group->OffsetX = 0;
+  Group->OffsetY = 0;
+  Group->CurrentClipRect = 0;
+  Group->ClipRectCount = 1;
+  Group->ClipRects[0] = {0, Buffer->Height, 0, Buffer->Width};
+}
+
+internal void EndRender(render_group *Group) {
+  if (Group->EntryCount > 0) {
+    TiledRenderGroupToOutput(Group, Group->Buffer);
+  }
+  Group->EntryCount = 0;
+}
+
+internal render_entry *PushRenderEntry(render_group *Group,
+                                       render_entry_type Type) {
+  if (Group->EntryCount == Group->MaxEntryCount) {
+    // Out of space, draw what we've got so far.
+    // NOTE: layers only hold within one batch
+    EndRender(Group);
+  }
+
+  render_entry *Entry = &Group->Entries[Group->EntryCount++];
+  *Entry = {};
+  Entry->Type = Type;
+  Entry->Layer = Group->CurrentLayer;
+  Entry->ClipRectIndex = Group->CurrentClipRect;
+
+  return Entry;
+}
+
+inline void SetRenderLayer(render_group *Group, render_layer Layer) {
+  Group->CurrentLayer = Layer;
+}
+
+// Everything pushed after this is moved by Offset and clipped to ClipRect,
+// both in buffer pixels
+internal void SetRenderTransform(render_group *Group, int OffsetX,
+                                 int OffsetY, rect ClipRect) {
+  int Scale = Group->Scale;
+  Group->OffsetX = OffsetX;
+  Group->OffsetY = OffsetY;
+
+  ClipRect.Top = FloorDiv(ClipRect.Top, Scale);
+  ClipRect.Bottom = FloorDiv(ClipRect.Bottom, Scale);
+  ClipRect.Left = FloorDiv(ClipRect.Left, Scale);
+  ClipRect.Right = FloorDiv(ClipRect.Right, Scale);
+  ClipRect = IntersectRects(ClipRect, Group->ClipRects[0]);
+
+  for (int i = 0; i < Group->ClipRectCount; i++) {
+    rect *Existing = &Group->ClipRects[i];
+    if (Existing->Top == ClipRect.Top && Existing->Bottom == ClipRect.Bottom &&
+        Existing->Left == ClipRect.Left && Existing->Right == ClipRect.Right) {
+      Group->CurrentClipRect = i;
+      return;
+    }
+  }
+
+  Assert(Group->ClipRectCount < kMaxClipRectCount);
+  Group->CurrentClipRect = Group->ClipRectCount++;
+  Group->ClipRects[Group->CurrentClipRect] = ClipRect;
+}
+
+// Moves the rect into the native buffer, false if it's not visible at all
+inline bool32 TransformAndCull(render_group *Group, int *X, int *Y,
+                               int *Width, int *Height) {
+  int Scale = Group->Scale;
+  *X = FloorDiv(*X + Group->OffsetX, Scale);
+  *Y = FloorDiv(*Y + Group->OffsetY, Scale);
+  *Width /= Scale;
+  *Height /= Scale;
+
+  rect Rect = {*Y, *Y + *Height, *X, *X + *Width};
+  Rect = IntersectRects(Rect, Group->ClipRects[Group->CurrentClipRect]);
+
+  return !RectIsEmpty(Rect);
+}
+
+internal void PushClear(render_group *Group, u32 Color) {
+  render_entry *Entry = PushRenderEntry(Group, RenderEntry_Clear);
+  Entry->Layer = RenderLayer_Background;
+  Entry->ClipRectIndex = 0;
+  Entry->Color = Color;
+}
+
+internal void PushRectangle(render_group *Group, int X, int Y, int Width,
+                            int Height, u32 Color) {
+  if (!TransformAndCull(Group, &X, &Y, &Width, &Height)) return;
+
+  render_entry *Entry = PushRenderEntry(Group, RenderEntry_Rectangle);
+  Entry->X = X;
+  Entry->Y = Y;
+  Entry->Width = Width;
+  Entry->Height = Height;
+  Entry->Color = Color;
+}
+
+internal void PushSprite(render_group *Group, int X, int Y, int Width,
+                         int Height, int XOffset, int YOffset) {
+  if (!TransformAndCull(Group, &X, &Y, &Width, &Height)) return;
+
+  render_entry *Entry = PushRenderEntry(Group, RenderEntry_Sprite);
+  Entry->X = X;
+  Entry->Y = Y;
+  Entry->Width = Width;
+  Entry->Height = Height;
+  Entry->XOffset = XOffset / Group->Scale;
+  Entry->YOffset = YOffset / Group->Scale;
+}
+
+// Always goes to the tile layer, what to draw is decided by ResolveTile
+internal void PushTile(render_group *Group, int Col, int Row, int X, int Y,
+                       int Width, int Height) {
+  if (!TransformAndCull(Group, &X, &Y, &Width, &Height)) return;
+
+  render_entry *Entry = PushRenderEntry(Group, RenderEntry_Tile);
+  Entry->Layer = RenderLayer_Tiles;
+  Entry->IsTile = true;
+  Entry->Col = Col;
+  Entry->Row = Row;
+  Entry->X = X;
+  Entry->Y = Y;
+  Entry->Width = Width;
+  Entry->Height = Height;
+}
@@ -0,0 +1,132 @@
+#ifndef LODERUNNER_RENDER_H
+#define LODERUNNER_RENDER_H
+
+#include "loderunner.h"
+
+// The game doesn't draw anything directly. Draw calls are pushed into
+// a render group during the frame and executed at the end of it
+// by the render queue threads, each of them owning a horizontal
+// band of the backbuffer.
+//
+// Before execution the entries are sorted by layer and then by
+// the atlas region they read from, so the order of pushes only matters
+// within a layer for entries reading the same region. Level tiles are
+// pushed by position and resolved at the end of the frame, so redrawing
+// the same tile several times costs nothing extra.
+//
+// Entries are positioned through the current transform: an offset
+// into the buffer and a clip rect. Whatever falls outside the clip rect
+// is culled when pushed, so the level can be much bigger than the screen.
+//
+// The game positions things in buffer pixels, but the group renders into
+// a native buffer Scale times smaller with an atlas downsampled to match.
+// The native buffer is scaled back up into the platform buffer at the end
+// of the frame, which rewrites all of it every time.
+
+typedef enum {
+  RenderEntry_Clear,  // fills the whole buffer, ignores the transform
+  RenderEntry_Rectangle,
+  RenderEntry_Sprite,
+  RenderEntry_Tile,  // resolved into one of the above before sorting
+} render_entry_type;
+
+typedef enum {
+  RenderLayer_Background,
+  RenderLayer_Tiles,
+  RenderLayer_Effects,
+  RenderLayer_Treasures,
+  RenderLayer_Debug,
+  RenderLayer_Players,
+  RenderLayer_Enemies,
+  RenderLayer_Interface,
+  RenderLayer_Cursor,
+} render_layer;
+
+struct render_entry {
+  render_entry_type Type;
+  render_layer Layer;
+  int ClipRectIndex;
+  int X;  // in native pixels
+  int Y;
+  int Width;
+  int Height;
+
+  u32 Color;    // Clear, Rectangle
+  int XOffset;  // Sprite, the position in the native atlas
+  int YOffset;
+  int SrcWidth;  // Sprite, less than Width when tiles are merged into a run
+
+  bool32 IsTile;  // the level tile at Col, Row
+  int Col;
+  int Row;
+};
+
+// Turns a RenderEntry_Tile into what the tile looks like right now.
+// Atlas offsets are set in full size pixels like for PushSprite.
+// Context is whatever was passed to AllocateRenderGroup.
+#define RESOLVE_TILE(name) void name(void *Context, render_entry *Entry)
+typedef RESOLVE_TILE(resolve_tile);
+
+const int kMaxClipRectCount = 8;
+
+struct sort_entry {
+  u64 Key;
+  u32 Index;
+};
+
+struct render_group {
+  bmp_file *Image;  // the sprite atlas, downsampled
+  int Scale;
+
+  int MaxEntryCount;
+  int EntryCount;
+  render_entry *Entries;
+  render_layer CurrentLayer;
+  resolve_tile *ResolveTile;
+  void *ResolveTileContext;
+
+  // Transform, applied to entries when they're pushed
+  int OffsetX;  // in buffer pixels
+  int OffsetY;
+  int CurrentClipRect;
+  int ClipRectCount;
+  rect ClipRects[kMaxClipRectCount];  // native, the first one is everything
+
+  // Options
+  bool32 SortEntries;
+  bool32 MergeTileRuns;
+
+  // What actually gets drawn, sorted and merged
+  int OutputEntryCount;
+  render_entry *OutputEntries;
+  render_entry *SortedEntries;
+  sort_entry *SortEntries0;
+  sort_entry *SortEntries1;
+
+  // Set by BeginRender, valid until EndRender
+  game_memory *Memory;
+  game_offscreen_buffer *Buffer;
+};
+
+struct band_render_work {
+  render_group *Group;
+  game_offscreen_buffer *Buffer;
+  rect ClipRect;
+};
+
+struct upscale_work {
+  game_offscreen_buffer *Source;
+  game_offscreen_buffer *Dest;
+  int Scale;
+  int FirstRow;  // in the source
+  int EndRow;
+  u32 BorderColor;  // for what the scaled image doesn't cover
+};
+
+// Entries drawn at once, a full group is drawn and starts over.
+// Enough for a screenful of tiles twice without that.
+const int kMaxRenderEntryCount = 20000;
+const int kRenderBandCount = 16;
+const int kDefaultRenderScale = 2;
+
+#endif  // LODERUNNER_RENDER_H
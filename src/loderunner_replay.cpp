@@ -0,0 +1,529 @@
+// Input recording and playback, shared by the platform layers.
+//
+// A replay is the game's start level and random seed followed by the input
+// of every frame that ran at least one tick, together with its tick count.
+// Given those the game plays out exactly the same way again. Only EndedDown
+// is kept, 16 bits for both players, and identical frames following each
+// other are stored once with a repeat count.
+//
+// After the header the file is a list of runs:
+//   u8      low 4 bits: ticks per frame, bit 4: player 1 buttons follow,
+//           bit 5: player 2 buttons follow (no buttons down otherwise)
+//   u8      player 1 buttons, bit N is Buttons[N], if present
+//   u8      player 2 buttons, if present
+//   varint  how many frames in a row, 7 bits per byte, low bits first
+//
+// Every so often the runs are interrupted by a keyframe, the full game
+// state as saved by GameSaveState after the frames before it:
+//   u8      0, which can't start a run
+//   varint  the size of the state
+//   ...     the state, packed: a control byte N below 128 is followed
+//           by N + 1 bytes as they are, N above 128 by one byte to be
+//           repeated N - 126 times
+//
+// The keyframes are listed in the index at the end of the file, so
+// seeking only means loading the nearest one and simulating the frames
+// between it and where we want to be.
+//
+// Since version 3 there's also the game's state hash every so often, as
+// it was after the frames before it:
+//   u8      0x40, which can't start a run either
+//   varint  the tick it was taken at
+//   u64     the hash
+// Playback checks them against the game's own, so a game that plays out
+// differently from the recording is caught within that many ticks.
+
+#include <stdlib.h>
+
+#include "loderunner.h"
+
+#define REPLAY_MAGIC 0x5052524C  // "LRRP"
+#define REPLAY_VERSION 3
+#define REPLAY_OLDEST_VERSION 2  // the same but without the hashes
+
+// Game time between keyframes. Shorter makes seeking faster
+// and replays bigger.
+#define REPLAY_KEYFRAME_INTERVAL (10 * kTicksPerSecond)
+
+// Game time between state hashes by default
+#define REPLAY_HASH_INTERVAL kTicksPerSecond
+
+#define REPLAY_HASH_FLAGS 0x40
+
+struct replay_header {
+  u32 Magic;
+  u32 Version;
+  i32 StartLevel;
+  u32 KeyframeCount;
+  u64 RandomSeed;
+  u64 FrameCount;
+  u64 TickCount;
+  u64 IndexOffset;  // where the keyframe index starts, after the header
+};
+
+// An entry of the index
+struct replay_keyframe {
+  u64 Frame;   // how many frames were played before it
+  u64 Tick;    // and how many ticks
+  u64 Offset;  // where it is, after the header
+};
+
+struct replay_run {
+  u16 Buttons;
+  int TicksPerFrame;
+  u64 FrameCount;
+};
+
+struct replay_recording {
+  replay_header Header;
+
+  int Size;
+  int MaxSize;
+  u8 *Data;
+
+  replay_run Run;  // not written until something different comes along
+
+  u64 NextKeyframeTick;
+  int KeyframeCount;
+  int MaxKeyframeCount;
+  replay_keyframe *Keyframes;
+
+  int MaxStateSize;
+  u8 *State;  // what the game saves the keyframes into
+
+  u64 HashInterval;  // in ticks
+  u64 NextHashTick;
+};
+
+struct replay_playback {
+  replay_header Header;
+
+  int Size;  // of the runs, the index comes after them
+  int At;
+  u8 *Data;
+  replay_keyframe *Keyframes;
+
+  replay_run Run;  // FrameCount is how many frames it has left
+  u64 FramesPlayed;
+  u64 TicksPlayed;
+
+  int MaxStateSize;
+  u8 *State;  // what the keyframes are unpacked into
+
+  u64 HashesChecked;
+  u64 LastGoodTick;  // the last tick the hashes agreed on
+  bool32 Desynced;
+  u64 DesyncTick;  // the first tick they didn't, once Desynced
+};
+
+internal u16 ReplayPackButtons(game_input *Input) {
+  u16 Result = 0;
+  for (int p = 0; p < 2; p++) {
+    for (int b = 0; b < INPUT_BUTTON_COUNT; b++) {
+      if (Input->Players[p].Buttons[b].EndedDown) {
+        Result = (u16)(Result | (1 << (p * 8 + b)));
+      }
+    }
+  }
+  return Result;
+}
+
+internal void ReplayPutByte(replay_recording *Recording, u8 Byte) {
+  if (Recording->Size == Recording->MaxSize) {
+    Recording->MaxSize = Recording->MaxSize ? Recording->MaxSize * 2 : 4096;
+    Recording->Data = (u8 *)realloc(Recording->Data, Recording->MaxSize);
+  }
+  Recording->Data[Recording->Size++] = Byte;
+}
+
+internal void ReplayPutVarint(replay_recording *Recording, u64 Value) {
+  while (Value >= 0x80) {
+    ReplayPutByte(Recording, (u8)(Value | 0x80));
+    Value >>= 7;
+  }
+  ReplayPutByte(Recording, (u8)Value);
+}
+
+internal void ReplayWriteRun(replay_recording *Recording) {
+  replay_run *Run = &Recording->Run;
+  if (Run->FrameCount == 0) {
+    return;
+  }
+
+  u8 Player1 = (u8)(Run->Buttons & 0xFF);
+  u8 Player2 = (u8)(Run->Buttons >> 8);
+  u8 Flags = (u8)Run->TicksPerFrame;
+  if (Player1) Flags = (u8)(Flags | 0x10);
+  if (Player2) Flags = (u8)(Flags | 0x20);
+  ReplayPutByte(Recording, Flags);
+  if (Player1) ReplayPutByte(Recording, Player1);
+  if (Player2) ReplayPutByte(Recording, Player2);
+
+  ReplayPutVarint(Recording, Run->FrameCount);
+
+  Run->FrameCount = 0;
+}
+
+internal void ReplayBeginRecording(replay_recording *Recording, int StartLevel,
+                                   u64 RandomSeed) {
+  *Recording = {};
+  Recording->Header.Magic = REPLAY_MAGIC;
+  Recording->Header.Version = REPLAY_VERSION;
+  Recording->Header.StartLevel = StartLevel;
+  Recording->Header.RandomSeed = RandomSeed;
+  Recording->HashInterval = REPLAY_HASH_INTERVAL;
+}
+
+// Input is what was passed to the game, before the game got to change it
+internal void ReplayRecordFrame(replay_recording *Recording, game_input *Input,
+                                int TickCount) {
+  if (TickCount <= 0) {
+    return;  // nothing happened
+  }
+  Assert(TickCount <= 0x0F);
+
+  u16 Buttons = ReplayPackButtons(Input);
+  replay_run *Run = &Recording->Run;
+  if (Run->FrameCount > 0 &&
+      (Run->Buttons != Buttons || Run->TicksPerFrame != TickCount)) {
+    ReplayWriteRun(Recording);
+  }
+  Run->Buttons = Buttons;
+  Run->TicksPerFrame = TickCount;
+  Run->FrameCount++;
+
+  Recording->Header.FrameCount++;
+  Recording->Header.TickCount += (u64)TickCount;
+}
+
+internal void ReplayPackState(replay_recording *Recording, u8 *State,
+                              int Size) {
+  int i = 0;
+  while (i < Size) {
+    int Repeat = 1;
+    while (i + Repeat < Size && Repeat < 129 && State[i + Repeat] == State[i]) {
+      Repeat++;
+    }
+    if (Repeat >= 3) {
+      ReplayPutByte(Recording, (u8)(Repeat + 126));
+      ReplayPutByte(Recording, State[i]);
+      i += Repeat;
+      continue;
+    }
+
+    // Everything up to the next repeat
+    int Start = i;
+    while (i < Size && i - Start < 128) {
+      if (i + 2 < Size && State[i] == State[i + 1] &&
+          State[i] == State[i + 2]) {
+        break;
+      }
+      i++;
+    }
+    ReplayPutByte(Recording, (u8)(i - Start - 1));
+    for (int j = Start; j < i; j++) {
+      ReplayPutByte(Recording, State[j]);
+    }
+  }
+}
+
+// Call after every frame, saves a keyframe when it's time for one.
+// The first one is saved straight away so that seeking can go anywhere.
+internal void ReplayRecordKeyframe(replay_recording *Recording,
+                                   game_memory *Memory,
+                                   game_save_state *SaveState) {
+  if (SaveState == NULL ||
+      Recording->Header.TickCount < Recording->NextKeyframeTick) {
+    return;
+  }
+  Recording->NextKeyframeTick =
+      Recording->Header.TickCount + REPLAY_KEYFRAME_INTERVAL;
+
+  int StateSize = SaveState(Memory, Recording->State, Recording->MaxStateSize);
+  if (StateSize > Recording->MaxStateSize) {
+    Recording->MaxStateSize = StateSize;
+    Recording->State = (u8 *)realloc(Recording->State, StateSize);
+    SaveState(Memory, Recording->State, Recording->MaxStateSize);
+  }
+
+  if (Recording->KeyframeCount == Recording->MaxKeyframeCount) {
+    Recording->MaxKeyframeCount =
+        Recording->MaxKeyframeCount ? Recording->MaxKeyframeCount * 2 : 64;
+    Recording->Keyframes = (replay_keyframe *)realloc(
+        Recording->Keyframes,
+        Recording->MaxKeyframeCount * sizeof(replay_keyframe));
+  }
+
+  // The frames before it are written first
+  ReplayWriteRun(Recording);
+
+  replay_keyframe *Keyframe = &Recording->Keyframes[Recording->KeyframeCount++];
+  Keyframe->Frame = Recording->Header.FrameCount;
+  Keyframe->Tick = Recording->Header.TickCount;
+  Keyframe->Offset = (u64)Recording->Size;
+
+  ReplayPutByte(Recording, 0);
+  ReplayPutVarint(Recording, (u64)StateSize);
+  ReplayPackState(Recording, Recording->State, StateSize);
+}
+
+// Call after every frame, stores the game's state hash every HashInterval
+// ticks. An interval of 1 pins a desync down to the exact tick.
+internal void ReplayRecordHash(replay_recording *Recording,
+                               game_memory *Memory) {
+  if (Recording->HashInterval == 0 ||
+      Recording->Header.TickCount < Recording->NextHashTick) {
+    return;
+  }
+  Recording->NextHashTick =
+      Recording->Header.TickCount + Recording->HashInterval;
+
+  ReplayWriteRun(Recording);
+
+  ReplayPutByte(Recording, REPLAY_HASH_FLAGS);
+  ReplayPutVarint(Recording, Recording->Header.TickCount);
+  u64 Hash = Memory->StateHash;
+  for (int i = 0; i < 8; i++) {
+    ReplayPutByte(Recording, (u8)(Hash >> (i * 8)));
+  }
+}
+
+// Flushes what's pending and adds the index, the file is then Header
+// followed by Size bytes of Data
+internal void ReplayEndRecording(replay_recording *Recording) {
+  ReplayWriteRun(Recording);
+
+  Recording->Header.IndexOffset = (u64)Recording->Size;
+  Recording->Header.KeyframeCount = (u32)Recording->KeyframeCount;
+  u8 *Index = (u8 *)Recording->Keyframes;
+  for (int i = 0; i < Recording->KeyframeCount * (int)sizeof(replay_keyframe);
+       i++) {
+    ReplayPutByte(Recording, Index[i]);
+  }
+}
+
+// File stays owned by the caller and has to outlive the playback
+internal bool32 ReplayBeginPlayback(replay_playback *Playback, void *File,
+                                    int FileSize) {
+  *Playback = {};
+
+  if (FileSize < (int)sizeof(replay_header)) {
+    return false;
+  }
+  replay_header *Header = &Playback->Header;
+  *Header = *(replay_header *)File;
+  if (Header->Magic != REPLAY_MAGIC ||
+      Header->Version < REPLAY_OLDEST_VERSION ||
+      Header->Version > REPLAY_VERSION) {
+    return false;
+  }
+
+  u64 DataSize = (u64)FileSize - sizeof(replay_header);
+  if (Header->IndexOffset > DataSize ||
+      (DataSize - Header->IndexOffset) / sizeof(replay_keyframe) <
+          Header->KeyframeCount) {
+    return false;
+  }
+  Playback->Data = (u8 *)File + sizeof(replay_header);
+  Playback->Size = (int)Header->IndexOffset;
+  Playback->Keyframes =
+      (replay_keyframe *)(Playback->Data + Header->IndexOffset);
+
+  return true;
+}
+
+internal bool32 ReplayReadVarint(replay_playback *Playback, u64 *Value) {
+  *Value = 0;
+  for (int Shift = 0; Shift <= 63; Shift += 7) {
+    if (Playback->At >= Playback->Size) {
+      return false;  // cut short
+    }
+    u8 Byte = Playback->Data[Playback->At++];
+    *Value |= (u64)(Byte & 0x7F) << Shift;
+    if (!(Byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Dest can be NULL to skip the state
+internal bool32 ReplayUnpackState(replay_playback *Playback, u8 *Dest,
+                                  int Size) {
+  int Written = 0;
+  while (Written < Size) {
+    if (Playback->At >= Playback->Size) {
+      return false;
+    }
+    u8 Control = Playback->Data[Playback->At++];
+    int Count = (Control < 128) ? Control + 1 : Control - 126;
+    int Read = (Control < 128) ? Count : 1;
+    if (Written + Count > Size || Playback->At + Read > Playback->Size) {
+      return false;
+    }
+    if (Dest && Control < 128) {
+      memcpy(Dest + Written, Playback->Data + Playback->At, Count);
+    } else if (Dest) {
+      memset(Dest + Written, Playback->Data[Playback->At], Count);
+    }
+    Playback->At += Read;
+    Written += Count;
+  }
+  return true;
+}
+
+// Memory is the game as it is before the run, to check the hashes against
+internal bool32 ReplayReadRun(replay_playback *Playback, game_memory *Memory) {
+  replay_run Run = {};
+
+  u8 Flags = 0;
+  for (;;) {
+    if (Playback->At >= Playback->Size) {
+      return false;
+    }
+    Flags = Playback->Data[Playback->At++];
+    if (Flags == REPLAY_HASH_FLAGS) {
+      u64 Tick;
+      if (!ReplayReadVarint(Playback, &Tick) ||
+          Playback->At + 8 > Playback->Size) {
+        return false;
+      }
+      u64 Hash = 0;
+      for (int i = 0; i < 8; i++) {
+        Hash |= (u64)Playback->Data[Playback->At++] << (i * 8);
+      }
+
+      if (Tick != Playback->TicksPlayed) {
+        return false;  // the runs before it don't add up
+      }
+      Playback->HashesChecked++;
+      if (Hash == Memory->StateHash) {
+        if (!Playback->Desynced) {
+          Playback->LastGoodTick = Tick;
+        }
+      } else if (!Playback->Desynced) {
+        Playback->Desynced = true;
+        Playback->DesyncTick = Tick;
+      }
+      continue;
+    }
+    if (Flags != 0) {
+      break;
+    }
+
+    // A keyframe, not needed when playing from the start
+    u64 StateSize;
+    if (!ReplayReadVarint(Playback, &StateSize) ||
+        !ReplayUnpackState(Playback, NULL, (int)StateSize)) {
+      return false;
+    }
+  }
+
+  Run.TicksPerFrame = Flags & 0x0F;
+  if ((Flags & 0x10) && Playback->At < Playback->Size) {
+    Run.Buttons = Playback->Data[Playback->At++];
+  }
+  if ((Flags & 0x20) && Playback->At < Playback->Size) {
+    Run.Buttons = (u16)(Run.Buttons | (Playback->Data[Playback->At++] << 8));
+  }
+  if (!ReplayReadVarint(Playback, &Run.FrameCount)) {
+    return false;
+  }
+
+  if (Run.TicksPerFrame == 0 || Run.FrameCount == 0) {
+    return false;
+  }
+  Playback->Run = Run;
+  return true;
+}
+
+// Fills in the buttons and the tick count of the next frame, and checks
+// the hashes stored before it. Returns false once the replay is over.
+internal bool32 ReplayNextFrame(replay_playback *Playback, game_input *Input,
+                                game_memory *Memory) {
+  if (Playback->Run.FrameCount == 0 && !ReplayReadRun(Playback, Memory)) {
+    return false;
+  }
+  replay_run *Run = &Playback->Run;
+
+  for (int p = 0; p < 2; p++) {
+    for (int b = 0; b < INPUT_BUTTON_COUNT; b++) {
+      game_button_state *Button = &Input->Players[p].Buttons[b];
+      bool32 IsDown = (Run->Buttons >> (p * 8 + b)) & 1;
+      if (Button->EndedDown != IsDown) {
+        Button->EndedDown = IsDown;
+        Button->HalfTransitionCount++;
+      }
+    }
+  }
+  Input->TickCount = Run->TicksPerFrame;
+
+  Run->FrameCount--;
+  Playback->FramesPlayed++;
+  Playback->TicksPlayed += (u64)Run->TicksPerFrame;
+  return true;
+}
+
+// Loads the last keyframe at or before Tick and simulates the frames
+// after it until the game gets to Tick, or to the first frame after it
+// if Tick is in the middle of one. Input ends up with the buttons of the
+// last frame played. Returns false if there's no keyframe to load, the
+// game and the playback are left as they were then.
+internal bool32 ReplaySeek(replay_playback *Playback, u64 Tick,
+                           game_memory *Memory, game_input *Input,
+                           platform_sound_output *SoundOutput,
+                           game_load_state *LoadState,
+                           game_update_and_render *UpdateAndRender) {
+  int KeyframeCount = (int)Playback->Header.KeyframeCount;
+  if (KeyframeCount == 0 || LoadState == NULL) {
+    return false;
+  }
+
+  // The keyframes are in order
+  int First = 0;
+  int Last = KeyframeCount - 1;
+  while (First < Last) {
+    int Middle = (First + Last + 1) / 2;
+    if (Playback->Keyframes[Middle].Tick <= Tick) {
+      First = Middle;
+    } else {
+      Last = Middle - 1;
+    }
+  }
+  replay_keyframe *Keyframe = &Playback->Keyframes[First];
+  if (Keyframe->Offset >= (u64)Playback->Size) {
+    return false;
+  }
+
+  int OldAt = Playback->At;
+  Playback->At = (int)Keyframe->Offset;
+  u64 StateSize = 0;
+  bool32 IsValid = Playback->Data[Playback->At++] == 0 &&
+                   ReplayReadVarint(Playback, &StateSize) &&
+                   StateSize <= (1u << 30);
+  if (IsValid && (int)StateSize > Playback->MaxStateSize) {
+    Playback->MaxStateSize = (int)StateSize;
+    Playback->State = (u8 *)realloc(Playback->State, Playback->MaxStateSize);
+  }
+  if (!IsValid ||
+      !ReplayUnpackState(Playback, Playback->State, (int)StateSize) ||
+      !LoadState(Memory, Playback->State, (int)StateSize)) {
+    Playback->At = OldAt;
+    return false;
+  }
+
+  Playback->Run = {};
+  Playback->FramesPlayed = Keyframe->Frame;
+  Playback->TicksPlayed = Keyframe->Tick;
+  Playback->LastGoodTick = Keyframe->Tick;
+  Playback->Desynced = false;
+
+  while (Playback->TicksPlayed < Tick &&
+         ReplayNextFrame(Playback, Input, Memory)) {
+    if (UpdateAndRender(Input, NULL, Memory, SoundOutput, false) != 0) {
+      break;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,291 @@
+// Rewinding, shared by the platform layers.
+//
+// After every frame that ran a tick the game state is saved into a ring
+// buffer. Most of the state stays the same from one frame to the next,
+// so each snapshot is stored XORed with the last keyframe, which leaves
+// mostly zeros. Keyframes themselves are XORed with nothing. Either way
+// what's stored is a list of
+//   varint  how many 8 byte words of zeros
+//   varint  how many words follow that aren't
+//   ...     those words
+// covering the whole state. The state's size follows the level, so a
+// snapshot of a different size than its keyframe becomes a keyframe too.
+//
+// Going back drops the newest snapshot and loads the one before it. Once
+// the buffer is full, or holds as many frames as it was asked to, the
+// oldest keyframe goes away together with the snapshots that need it.
+
+#include <stdlib.h>
+
+#include "loderunner.h"
+
+#define REWIND_KEYFRAME_INTERVAL 60  // snapshots
+
+struct rewind_snapshot {
+  u64 Index;
+  u64 KeyframeIndex;  // the same as Index for keyframes
+  int Offset;         // in Data
+  int Size;
+  int GameStateSize;  // before packing
+};
+
+struct rewind_buffer {
+  int GameStateSize;  // of the state in State
+  int StateCapacity;  // of State and Keyframe, a whole number of words
+  u8 *State;          // what the game saves into and loads from
+  u8 *Keyframe;       // the state of the keyframe KeyframeIndex
+  int KeyframeSize;
+  u64 KeyframeIndex;
+  bool32 HasKeyframe;
+  u8 *Packed;
+
+  int MaxSize;
+  int Used;
+  u8 *Data;
+
+  int MaxSnapshotCount;
+  int FirstSnapshot;
+  int SnapshotCount;
+  rewind_snapshot *Snapshots;
+  u64 NextIndex;
+  int SinceKeyframe;
+};
+
+// Keeps at least MaxFrames, unless they don't fit into MaxSize bytes.
+// Snapshots go away a keyframe at a time, so up to a keyframe interval
+// more can be kept.
+internal void RewindInit(rewind_buffer *Rewind, int MaxSize, int MaxFrames) {
+  *Rewind = {};
+  Rewind->MaxSize = MaxSize;
+  Rewind->Data = (u8 *)malloc(MaxSize);
+  Rewind->MaxSnapshotCount = MaxFrames + REWIND_KEYFRAME_INTERVAL;
+  Rewind->Snapshots = (rewind_snapshot *)calloc(Rewind->MaxSnapshotCount,
+                                                sizeof(rewind_snapshot));
+}
+
+inline rewind_snapshot *RewindGetSnapshot(rewind_buffer *Rewind, int i) {
+  return &Rewind->Snapshots[(Rewind->FirstSnapshot + i) %
+                            Rewind->MaxSnapshotCount];
+}
+
+internal u8 *RewindPutVarint(u8 *At, u64 Value) {
+  while (Value >= 0x80) {
+    *At++ = (u8)(Value | 0x80);
+    Value >>= 7;
+  }
+  *At++ = (u8)Value;
+  return At;
+}
+
+internal u8 *RewindGetVarint(u8 *At, int *Value) {
+  u64 Result = 0;
+  for (int Shift = 0;; Shift += 7) {
+    u8 Byte = *At++;
+    Result |= (u64)(Byte & 0x7F) << Shift;
+    if (!(Byte & 0x80)) {
+      break;
+    }
+  }
+  *Value = (int)Result;
+  return At;
+}
+
+inline int RewindGetWordCount(int GameStateSize) {
+  return (GameStateSize + 7) / 8;
+}
+
+// Packs State XOR Base into Packed, Base can be NULL. Returns the size.
+internal int RewindPack(rewind_buffer *Rewind, u8 *Base) {
+  u64 *State = (u64 *)Rewind->State;
+  u64 *Keyframe = (u64 *)Base;
+  int WordCount = RewindGetWordCount(Rewind->GameStateSize);
+  u8 *At = Rewind->Packed;
+
+  int Word = 0;
+  while (Word < WordCount) {
+    int Start = Word;
+    while (Word < WordCount &&
+           (State[Word] ^ (Keyframe ? Keyframe[Word] : 0)) == 0) {
+      Word++;
+    }
+    At = RewindPutVarint(At, (u64)(Word - Start));
+
+    // Single zero words between changes aren't worth breaking the run for
+    Start = Word;
+    while (Word < WordCount) {
+      u64 Value = State[Word] ^ (Keyframe ? Keyframe[Word] : 0);
+      u64 Next = (Word + 1 < WordCount)
+                     ? State[Word + 1] ^ (Keyframe ? Keyframe[Word + 1] : 0)
+                     : 0;
+      if (Value == 0 && Next == 0) {
+        break;
+      }
+      Word++;
+    }
+    At = RewindPutVarint(At, (u64)(Word - Start));
+    for (int i = Start; i < Word; i++) {
+      u64 Value = State[i] ^ (Keyframe ? Keyframe[i] : 0);
+      memcpy(At, &Value, 8);
+      At += 8;
+    }
+  }
+
+  return (int)(At - Rewind->Packed);
+}
+
+// Rebuilds State from a snapshot, XORed with Base unless it's NULL
+internal void RewindUnpack(rewind_buffer *Rewind, rewind_snapshot *Snapshot,
+                           u8 *Base, u8 *Dest) {
+  u64 *Keyframe = (u64 *)Base;
+  u64 *State = (u64 *)Dest;
+  int WordCount = RewindGetWordCount(Snapshot->GameStateSize);
+  u8 *At = Rewind->Data + Snapshot->Offset;
+
+  int Word = 0;
+  while (Word < WordCount) {
+    int Count;
+    At = RewindGetVarint(At, &Count);
+    for (int i = 0; i < Count; i++, Word++) {
+      State[Word] = Keyframe ? Keyframe[Word] : 0;
+    }
+    At = RewindGetVarint(At, &Count);
+    for (int i = 0; i < Count; i++, Word++) {
+      u64 Value;
+      memcpy(&Value, At, 8);
+      At += 8;
+      State[Word] = Value ^ (Keyframe ? Keyframe[Word] : 0);
+    }
+  }
+}
+
+internal void RewindDropOldest(rewind_buffer *Rewind) {
+  // Snapshots can't outlive their keyframe
+  do {
+    Rewind->Used -= RewindGetSnapshot(Rewind, 0)->Size;
+    Rewind->FirstSnapshot =
+        (Rewind->FirstSnapshot + 1) % Rewind->MaxSnapshotCount;
+    Rewind->SnapshotCount--;
+  } while (Rewind->SnapshotCount > 0 &&
+           RewindGetSnapshot(Rewind, 0)->KeyframeIndex !=
+               RewindGetSnapshot(Rewind, 0)->Index);
+}
+
+// Call after every frame that ran at least one tick
+internal void RewindSave(rewind_buffer *Rewind, game_memory *Memory,
+                         game_save_state *SaveState) {
+  if (SaveState == NULL || Rewind->Data == NULL) {
+    return;
+  }
+  Rewind->GameStateSize = SaveState(Memory, NULL, 0);
+  int StateSize = RewindGetWordCount(Rewind->GameStateSize) * 8;
+  if (StateSize > Rewind->StateCapacity) {
+    // Only ever grows, so the older keyframes still fit
+    Rewind->State = (u8 *)realloc(Rewind->State, StateSize);
+    Rewind->Keyframe = (u8 *)realloc(Rewind->Keyframe, StateSize);
+    // Nothing packs worse than every word with its two counts
+    Rewind->Packed = (u8 *)realloc(Rewind->Packed, StateSize * 2 + 16);
+    Rewind->StateCapacity = StateSize;
+  }
+  memset(Rewind->State, 0, StateSize);  // the padding packs as zeros
+  SaveState(Memory, Rewind->State, StateSize);
+
+  bool32 IsKeyframe = !Rewind->HasKeyframe ||
+                      Rewind->SinceKeyframe >= REWIND_KEYFRAME_INTERVAL ||
+                      Rewind->KeyframeSize != Rewind->GameStateSize;
+  int Size = RewindPack(Rewind, IsKeyframe ? NULL : Rewind->Keyframe);
+  int Offset = 0;
+  for (;;) {
+    if (Size > Rewind->MaxSize) {
+      return;  // too small to keep anything
+    }
+
+    // Make room, it goes after the newest one or at the start of Data
+    Offset = 0;
+    if (Rewind->SnapshotCount > 0) {
+      rewind_snapshot *Newest =
+          RewindGetSnapshot(Rewind, Rewind->SnapshotCount - 1);
+      Offset = Newest->Offset + Newest->Size;
+      if (Offset + Size > Rewind->MaxSize) {
+        Offset = 0;
+      }
+    }
+    while (Rewind->SnapshotCount > 0) {
+      rewind_snapshot *Oldest = RewindGetSnapshot(Rewind, 0);
+      bool32 Overlaps = Oldest->Offset < Offset + Size &&
+                        Offset < Oldest->Offset + Oldest->Size;
+      if (!Overlaps && Rewind->SnapshotCount < Rewind->MaxSnapshotCount) {
+        break;
+      }
+      RewindDropOldest(Rewind);
+    }
+
+    if (IsKeyframe || (Rewind->SnapshotCount > 0 &&
+                       RewindGetSnapshot(Rewind, 0)->Index <=
+                           Rewind->KeyframeIndex)) {
+      break;
+    }
+    // Its keyframe had to go, so this one becomes a keyframe
+    IsKeyframe = true;
+    Size = RewindPack(Rewind, NULL);
+  }
+
+  rewind_snapshot *Snapshot =
+      RewindGetSnapshot(Rewind, Rewind->SnapshotCount++);
+  Snapshot->Index = Rewind->NextIndex++;
+  Snapshot->Offset = Offset;
+  Snapshot->Size = Size;
+  Snapshot->GameStateSize = Rewind->GameStateSize;
+  memcpy(Rewind->Data + Offset, Rewind->Packed, Size);
+  Rewind->Used += Size;
+
+  if (IsKeyframe) {
+    memcpy(Rewind->Keyframe, Rewind->State, StateSize);
+    Rewind->KeyframeSize = Rewind->GameStateSize;
+    Rewind->KeyframeIndex = Snapshot->Index;
+    Rewind->HasKeyframe = true;
+    Rewind->SinceKeyframe = 0;
+  }
+  Snapshot->KeyframeIndex = Rewind->KeyframeIndex;
+  Rewind->SinceKeyframe++;
+}
+
+// Goes one frame back. Returns false if there's nothing left to go back to.
+internal bool32 RewindStep(rewind_buffer *Rewind, game_memory *Memory,
+                           game_load_state *LoadState) {
+  if (LoadState == NULL || Rewind->SnapshotCount < 2) {
+    return false;
+  }
+
+  // The newest one is where the game is now
+  rewind_snapshot *Dropped =
+      RewindGetSnapshot(Rewind, --Rewind->SnapshotCount);
+  Rewind->Used -= Dropped->Size;
+
+  rewind_snapshot *Snapshot =
+      RewindGetSnapshot(Rewind, Rewind->SnapshotCount - 1);
+  if (!Rewind->HasKeyframe ||
+      Snapshot->KeyframeIndex != Rewind->KeyframeIndex) {
+    int i = Rewind->SnapshotCount - 1;
+    while (RewindGetSnapshot(Rewind, i)->Index != Snapshot->KeyframeIndex) {
+      i--;
+    }
+    RewindUnpack(Rewind, RewindGetSnapshot(Rewind, i), NULL,
+                 Rewind->Keyframe);
+    Rewind->KeyframeSize = Snapshot->GameStateSize;
+    Rewind->KeyframeIndex = Snapshot->KeyframeIndex;
+    Rewind->HasKeyframe = true;
+  }
+  Rewind->GameStateSize = Snapshot->GameStateSize;
+  if (Snapshot->Index == Snapshot->KeyframeIndex) {
+    memcpy(Rewind->State, Rewind->Keyframe,
+           RewindGetWordCount(Rewind->GameStateSize) * 8);
+  } else {
+    RewindUnpack(Rewind, Snapshot, Rewind->Keyframe, Rewind->State);
+  }
+
+  // New snapshots carry on from here
+  Rewind->NextIndex = Snapshot->Index + 1;
+  Rewind->SinceKeyframe = (int)(Rewind->NextIndex - Rewind->KeyframeIndex);
+
+  return LoadState(Memory, Rewind->State, Rewind->GameStateSize);
+}
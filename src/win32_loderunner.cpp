@@ -7,12 +7,33 @@
 #include <dsound.h>
 #include <gl/gl.h>
 
+#include "loderunner_replay.cpp"
+#include "loderunner_rewind.cpp"
+
 struct win32_game_code {
   HMODULE GameCodeDLL;
   game_update_and_render *UpdateAndRender;
+  game_save_state *SaveState;  // NULL if the game can't do it
+  game_load_state *LoadState;
   bool32 IsValid;
 };
 
+struct platform_work_queue_entry {
+  platform_work_queue_callback *Callback;
+  void *Data;
+};
+
+struct platform_work_queue {
+  u32 volatile CompletionGoal;
+  u32 volatile CompletionCount;
+
+  u32 volatile NextEntryToWrite;
+  u32 volatile NextEntryToRead;
+  HANDLE SemaphoreHandle;
+
+  platform_work_queue_entry Entries[256];
+};
+
 global bool GlobalRunning;
 
 // global BITMAPINFO GlobalBitmapInfo;
@@ -27,6 +48,8 @@ global platform_sound_output gSoundOutput;
 global game_memory GameMemory;
 global game_offscreen_buffer GameBackBuffer;
 global bool32 gRedrawLevel;
+global bool32 gRewinding;
+global i64 gMemoryCommitted;
 
 typedef HRESULT WINAPI directsound_create(LPCGUID, LPDIRECTSOUND *, LPUNKNOWN);
 
@@ -94,6 +117,63 @@ DEBUG_PLATFORM_READ_ENTIRE_FILE(DEBUGPlatformReadEntireFile) {
   return Result;
 }
 
+internal bool32 Win32LoadReplay(replay_playback *Playback, char const *Path) {
+  bool32 Result = false;
+
+  HANDLE FileHandle = CreateFile(Path, GENERIC_READ, FILE_SHARE_READ, 0,
+                                 OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+  if (FileHandle != INVALID_HANDLE_VALUE) {
+    LARGE_INTEGER FileSize;
+    if (GetFileSizeEx(FileHandle, &FileSize)) {
+      // Stays around for as long as the replay plays
+      void *File = VirtualAlloc(0, (SIZE_T)FileSize.QuadPart + 1, MEM_COMMIT,
+                                PAGE_READWRITE);
+      DWORD BytesRead = 0;
+      if (ReadFile(FileHandle, File, (u32)FileSize.QuadPart, &BytesRead, 0) &&
+          BytesRead == (DWORD)FileSize.QuadPart) {
+        Result = ReplayBeginPlayback(Playback, File, (int)BytesRead);
+      }
+    }
+    CloseHandle(FileHandle);
+  }
+
+  if (!Result) {
+    OutputDebugStringA("Cannot play the replay\n");
+  }
+  return Result;
+}
+
+internal void Win32SaveReplay(replay_recording *Recording, char const *Path) {
+  ReplayEndRecording(Recording);
+
+  HANDLE FileHandle = CreateFile(Path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL, 0);
+  if (FileHandle != INVALID_HANDLE_VALUE) {
+    DWORD BytesWritten = 0;
+    WriteFile(FileHandle, &Recording->Header, sizeof(Recording->Header),
+              &BytesWritten, 0);
+    WriteFile(FileHandle, Recording->Data, Recording->Size, &BytesWritten, 0);
+    CloseHandle(FileHandle);
+  } else {
+    OutputDebugStringA("Cannot write the replay\n");
+  }
+}
+
+// Copies the next space separated word of the command line into Word,
+// returns where to continue from
+internal char *Win32NextWord(char *At, char *Word, int MaxLength) {
+  while (*At == ' ') At++;
+  int Length = 0;
+  while (*At && *At != ' ') {
+    if (Length < MaxLength - 1) {
+      Word[Length++] = *At;
+    }
+    At++;
+  }
+  Word[Length] = 0;
+  return At;
+}
+
 internal void Win32UpdateWindow(HDC hdc) {
   // StretchDIBits(hdc, 0, 0, GameBackBuffer.Width, GameBackBuffer.Height,
   //               0, 0, GameBackBuffer.Width, GameBackBuffer.Height,
@@ -177,6 +257,14 @@ void Win32ToggleFullscreen(HWND hwnd) {
   }
 }
 
+internal PLATFORM_COMMIT_MEMORY(Win32CommitMemory) {
+  if (VirtualAlloc(Start, Size, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+    return false;
+  }
+  gMemoryCommitted += Size;
+  return true;
+}
+
 internal void Win32ResizeClientWindow(HWND Window) {
   if (!GameMemory.IsInitialized) return;  // no buffer yet
 
@@ -195,6 +283,13 @@ internal void Win32ResizeClientWindow(HWND Window) {
   GameBackBuffer.Width = Width;
   GameBackBuffer.Height = Height;
 
+  // Only what the window needs is committed, committing it again is fine
+  if (GameBackBuffer.Memory) {
+    VirtualAlloc(GameBackBuffer.Memory,
+                 Width * Height * GameBackBuffer.BytesPerPixel, MEM_COMMIT,
+                 PAGE_READWRITE);
+  }
+
   gRedrawLevel = true;
 
   // GlobalBitmapInfo.bmiHeader.biWidth = Width;
@@ -282,6 +377,8 @@ internal FILETIME Win32GetDLLWriteTime() {
 
 internal void Win32UnloadGameCode(win32_game_code *GameCode) {
   GameCode->UpdateAndRender = GameUpdateAndRenderStub;
+  GameCode->SaveState = NULL;
+  GameCode->LoadState = NULL;
   FreeLibrary(GameCode->GameCodeDLL);
   GameCode->IsValid = false;
 }
@@ -305,11 +402,112 @@ internal win32_game_code Win32LoadGameCode() {
     if (Result.UpdateAndRender) {
       Result.IsValid = true;
     }
+    Result.SaveState = (game_save_state *)GetProcAddress(Result.GameCodeDLL,
+                                                         "GameSaveState");
+    Result.LoadState = (game_load_state *)GetProcAddress(Result.GameCodeDLL,
+                                                         "GameLoadState");
   }
 
   return Result;
 }
 
+internal PLATFORM_ADD_ENTRY(Win32AddEntry) {
+  // NOTE: only one thread is supposed to add entries
+  u32 NewNextEntryToWrite =
+      (Queue->NextEntryToWrite + 1) % COUNT_OF(Queue->Entries);
+  Assert(NewNextEntryToWrite != Queue->NextEntryToRead);
+  platform_work_queue_entry *Entry = &Queue->Entries[Queue->NextEntryToWrite];
+  Entry->Callback = Callback;
+  Entry->Data = Data;
+  ++Queue->CompletionGoal;
+  _WriteBarrier();
+  Queue->NextEntryToWrite = NewNextEntryToWrite;
+  ReleaseSemaphore(Queue->SemaphoreHandle, 1, 0);
+}
+
+internal bool32 Win32DoNextWorkQueueEntry(platform_work_queue *Queue) {
+  bool32 WeShouldSleep = false;
+
+  u32 OriginalNextEntryToRead = Queue->NextEntryToRead;
+  u32 NewNextEntryToRead =
+      (OriginalNextEntryToRead + 1) % COUNT_OF(Queue->Entries);
+  if (OriginalNextEntryToRead != Queue->NextEntryToWrite) {
+    u32 Index = InterlockedCompareExchange((LONG volatile *)&Queue->NextEntryToRead,
+                                           NewNextEntryToRead,
+                                           OriginalNextEntryToRead);
+    if (Index == OriginalNextEntryToRead) {
+      platform_work_queue_entry Entry = Queue->Entries[Index];
+      Entry.Callback(Queue, Entry.Data);
+      InterlockedIncrement((LONG volatile *)&Queue->CompletionCount);
+    }
+  } else {
+    WeShouldSleep = true;
+  }
+
+  return WeShouldSleep;
+}
+
+internal PLATFORM_COMPLETE_ALL_WORK(Win32CompleteAllWork) {
+  // The calling thread helps out instead of just waiting
+  while (Queue->CompletionGoal != Queue->CompletionCount) {
+    Win32DoNextWorkQueueEntry(Queue);
+  }
+
+  Queue->CompletionGoal = 0;
+  Queue->CompletionCount = 0;
+}
+
+DWORD WINAPI Win32WorkerThreadProc(LPVOID lpParameter) {
+  platform_work_queue *Queue = (platform_work_queue *)lpParameter;
+
+  for (;;) {
+    if (Win32DoNextWorkQueueEntry(Queue)) {
+      WaitForSingleObjectEx(Queue->SemaphoreHandle, INFINITE, FALSE);
+    }
+  }
+}
+
+internal void Win32MakeQueue(platform_work_queue *Queue, u32 ThreadCount) {
+  Queue->CompletionGoal = 0;
+  Queue->CompletionCount = 0;
+  Queue->NextEntryToWrite = 0;
+  Queue->NextEntryToRead = 0;
+
+  u32 InitialCount = 0;
+  Queue->SemaphoreHandle = CreateSemaphoreEx(0, InitialCount, ThreadCount + 1,
+                                             0, 0, SEMAPHORE_ALL_ACCESS);
+
+  for (u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ++ThreadIndex) {
+    DWORD ThreadID;
+    HANDLE ThreadHandle =
+        CreateThread(0, 0, Win32WorkerThreadProc, Queue, 0, &ThreadID);
+    CloseHandle(ThreadHandle);
+  }
+}
+
+#if BUILD_INTERNAL
+internal void Win32HandleDebugCycleCounters(game_memory *Memory) {
+  const char *Names[DebugCycleCounter_Count] = {
+      "GameUpdateAndRender", "SortRenderEntries", "RenderGroupToOutput",
+      "UpscaleToOutput",
+  };
+
+  OutputDebugStringA("DEBUG CYCLE COUNTS:\n");
+  for (int i = 0; i < DebugCycleCounter_Count; i++) {
+    debug_cycle_counter *Counter = &Memory->Counters[i];
+    if (Counter->HitCount) {
+      char TextBuffer[256];
+      sprintf_s(TextBuffer, "  %s: %I64ucy %uh %I64ucy/h\n", Names[i],
+                Counter->CycleCount, Counter->HitCount,
+                Counter->CycleCount / Counter->HitCount);
+      OutputDebugStringA(TextBuffer);
+      Counter->CycleCount = 0;
+      Counter->HitCount = 0;
+    }
+  }
+}
+#endif
+
 internal void Win32ProcessKeyboardMessage(game_button_state *NewState,
                                           bool32 IsDown) {
   if (NewState->EndedDown != IsDown) {
@@ -362,6 +560,8 @@ internal void Win32ProcessPendingMessages(game_input *NewInput) {
             Win32ProcessKeyboardMessage(&Player1->Fire, IsDown);
           } else if (VKCode == VK_ESCAPE) {
             Win32ProcessKeyboardMessage(&Player1->Menu, IsDown);
+          } else if (VKCode == VK_BACK) {
+            gRewinding = IsDown;
           } else if (VKCode == 'W') {
             Win32ProcessKeyboardMessage(&Player2->Up, IsDown);
           } else if (VKCode == 'S') {
@@ -400,9 +600,6 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
   win32_game_code Game = Win32LoadGameCode();
   Assert(Game.IsValid);
 
-  // Random seed
-  srand((u32)time(NULL));
-
   WNDCLASS WindowClass = {};
   WindowClass.style = CS_OWNDC | CS_VREDRAW | CS_HREDRAW;
   WindowClass.lpfnWndProc = Win32WindowProc;
@@ -545,18 +742,94 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 
       // Init game memory
       {
+        // Reserved, the game commits what it uses. Huge pages would
+        // need a privilege most users don't have.
         GameMemory.MemorySize = 1024 * 1024 * 1024;  // 1 Gigabyte
         GameMemory.Start =
-            VirtualAlloc(0, GameMemory.MemorySize, MEM_COMMIT, PAGE_READWRITE);
-        // SecureZeroMemory(GameMemory.Start, GameMemory.MemorySize);
+            VirtualAlloc(0, GameMemory.MemorySize, MEM_RESERVE, PAGE_NOACCESS);
         GameMemory.Free = GameMemory.Start;
+        GameMemory.PlatformCommitMemory = Win32CommitMemory;
         GameMemory.IsInitialized = true;
+        GameMemory.RandomSeed = (u64)time(NULL);
 
         GameMemory.DEBUGPlatformReadEntireFile = DEBUGPlatformReadEntireFile;
         // GameMemory.DEBUGPlatformWriteEntireFile =
         // DEBUGPlatformWriteEntireFile;
       }
 
+      // --record FILE saves the input on exit, --replay FILE plays it back
+      // and then hands over to the keyboard. --replay-speed N plays N frames
+      // per frame shown, --seek T starts the replay from tick T.
+      // Holding backspace goes back in time. --rewind N keeps the last
+      // N seconds (30), --rewind-memory M at most M megabytes of them (64).
+      char RecordPath[MAX_PATH] = {};
+      char ReplayPath[MAX_PATH] = {};
+      int ReplaySpeed = 1;
+      u64 SeekTick = 0;
+      int RewindSeconds = 30;
+      int RewindMegabytes = 64;
+      {
+        char Option[MAX_PATH];
+        char Value[MAX_PATH];
+        char *At = lpCmdLine;
+        while (*At) {
+          At = Win32NextWord(At, Option, MAX_PATH);
+          At = Win32NextWord(At, Value, MAX_PATH);
+          if (strcmp(Option, "--record") == 0) {
+            strcpy_s(RecordPath, Value);
+          } else if (strcmp(Option, "--replay") == 0) {
+            strcpy_s(ReplayPath, Value);
+          } else if (strcmp(Option, "--replay-speed") == 0) {
+            ReplaySpeed = atoi(Value);
+          } else if (strcmp(Option, "--seek") == 0) {
+            SeekTick = _strtoui64(Value, NULL, 10);
+          } else if (strcmp(Option, "--rewind") == 0) {
+            RewindSeconds = atoi(Value);
+          } else if (strcmp(Option, "--rewind-memory") == 0) {
+            RewindMegabytes = atoi(Value);
+          }
+        }
+        if (ReplaySpeed < 1) {
+          ReplaySpeed = 1;
+        }
+      }
+
+      replay_playback Playback = {};
+      bool32 Replaying = false;
+      if (ReplayPath[0] && Win32LoadReplay(&Playback, ReplayPath)) {
+        GameMemory.StartLevel = Playback.Header.StartLevel;
+        GameMemory.RandomSeed = Playback.Header.RandomSeed;
+        Replaying = true;
+        RecordPath[0] = 0;  // not recording a replay
+      }
+
+      replay_recording Recording = {};
+      if (RecordPath[0]) {
+        ReplayBeginRecording(&Recording, GameMemory.StartLevel,
+                             GameMemory.RandomSeed);
+      }
+
+      // Not while recording, the replay would no longer match
+      rewind_buffer Rewind = {};
+      if (!RecordPath[0] && RewindSeconds > 0 && RewindMegabytes > 0) {
+        RewindInit(&Rewind, RewindMegabytes * 1024 * 1024,
+                   RewindSeconds * TargetFPS);
+      }
+
+      // Init render threads. The main thread joins in while waiting
+      // for the work to finish, so we need one thread less than cores.
+      platform_work_queue RenderQueue = {};
+      {
+        SYSTEM_INFO SystemInfo;
+        GetSystemInfo(&SystemInfo);
+        u32 CoreCount = SystemInfo.dwNumberOfProcessors;
+        Win32MakeQueue(&RenderQueue, CoreCount > 1 ? CoreCount - 1 : 0);
+
+        GameMemory.RenderQueue = &RenderQueue;
+        GameMemory.PlatformAddEntry = Win32AddEntry;
+        GameMemory.PlatformCompleteAllWork = Win32CompleteAllWork;
+      }
+
       // Init backbuffer
       {
         GameBackBuffer.MaxWidth = 2000;
@@ -565,9 +838,9 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 
         int BufferSize = GameBackBuffer.MaxWidth * GameBackBuffer.MaxHeight *
                          GameBackBuffer.BytesPerPixel;
-        // TODO: put it into the game memory?
+        // Reserved, resizing the window commits what it needs
         GameBackBuffer.Memory =
-            VirtualAlloc(0, BufferSize, MEM_COMMIT, PAGE_READWRITE);
+            VirtualAlloc(0, BufferSize, MEM_RESERVE, PAGE_NOACCESS);
 
         // GlobalBitmapInfo.bmiHeader.biSize = sizeof(GlobalBitmapInfo.bmiHeader);
         // GlobalBitmapInfo.bmiHeader.biPlanes = 1;
@@ -585,8 +858,20 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
       game_input *NewInput = &Input[1];
       *NewInput = {};
 
+      if (Replaying && SeekTick > 0 &&
+          !ReplaySeek(&Playback, SeekTick, &GameMemory, NewInput,
+                      &gSoundOutput, Game.LoadState, Game.UpdateAndRender)) {
+        OutputDebugStringA("Cannot seek, playing from the start\n");
+      }
+
       FILETIME LastDLLWriteTime = Win32GetDLLWriteTime();
 
+#if BUILD_INTERNAL
+      int DebugFrameCount = 0;
+#endif
+
+      LastTimestamp = Win32GetWallClock();
+
       // Main loop
       while (GlobalRunning) {
 #if BUILD_INTERNAL
@@ -601,15 +886,89 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 
         // Collect input
         Win32ProcessPendingMessages(NewInput);
-        NewInput->dtForFrame = TargetMSPF;
 
-        int Result =
-            Game.UpdateAndRender(NewInput, &GameBackBuffer, &GameMemory,
-                                 &gSoundOutput, gRedrawLevel);
+        // The game catches up with however much time has actually passed
+        LARGE_INTEGER Now = Win32GetWallClock();
+        r32 dtForFrame =
+            Win32GetMillisecondsElapsed(LastTimestamp, Now) / 1000.0f;
+        LastTimestamp = Now;
+
+        int Result = 0;
+        if (Replaying) {
+          // The replay sets the input and the ticks. Frames beyond
+          // the first one are only simulated, the last one gets shown.
+          for (int i = 0; i < ReplaySpeed && Replaying; i++) {
+            bool32 WasDesynced = Playback.Desynced;
+            Replaying = ReplayNextFrame(&Playback, NewInput, &GameMemory);
+            if (Playback.Desynced && !WasDesynced) {
+              char Message[128];
+              sprintf_s(Message,
+                        "Replay desynced between tick %llu and %llu\n",
+                        Playback.LastGoodTick, Playback.DesyncTick);
+              OutputDebugStringA(Message);
+            }
+            if (Replaying && i < ReplaySpeed - 1 && Result == 0) {
+              Result = Game.UpdateAndRender(NewInput, NULL, &GameMemory,
+                                            &gSoundOutput, gRedrawLevel);
+            }
+          }
+          if (!Replaying) {
+            OutputDebugStringA("Replay finished\n");
+            *NewInput = {};
+          }
+        }
+        NewInput->dtForFrame = dtForFrame;
+        if (gRewinding && !Replaying && !RecordPath[0]) {
+          // Go one frame back and only show it
+          RewindStep(&Rewind, &GameMemory, Game.LoadState);
+          NewInput->dtForFrame = 0;
+        }
+
+        game_input RecordedInput = *NewInput;
+        u64 TicksBefore = GameMemory.Stats.Ticks;
+
+        if (Result == 0) {
+          Result = Game.UpdateAndRender(NewInput, &GameBackBuffer, &GameMemory,
+                                        &gSoundOutput, gRedrawLevel);
+        }
         if (Result > 0) {
           GlobalRunning = false;
         }
 
+        if (RecordPath[0]) {
+          ReplayRecordFrame(&Recording, &RecordedInput,
+                            (int)(GameMemory.Stats.Ticks - TicksBefore));
+          ReplayRecordKeyframe(&Recording, &GameMemory, Game.SaveState);
+          ReplayRecordHash(&Recording, &GameMemory);
+        }
+        if (!Replaying && GameMemory.Stats.Ticks != TicksBefore) {
+          RewindSave(&Rewind, &GameMemory, Game.SaveState);
+        }
+
+#if BUILD_INTERNAL
+        // Report once a second
+        if (++DebugFrameCount == TargetFPS) {
+          DebugFrameCount = 0;
+          Win32HandleDebugCycleCounters(&GameMemory);
+
+          char Line[256];
+          sprintf_s(Line, "  Rewind: %d frames in %dKB of %dKB\n",
+                    Rewind.SnapshotCount, Rewind.Used / 1024,
+                    Rewind.MaxSize / 1024);
+          OutputDebugStringA(Line);
+          for (int i = 0; i < GameArena_Count; i++) {
+            memory_arena *Arena = &GameMemory.Arenas[i];
+            sprintf_s(Line, "  Arena %s: %dKB used, at most %dKB of %dKB\n",
+                      kGameArenaNames[i], Arena->Used / 1024,
+                      Arena->HighWater / 1024, Arena->Size / 1024);
+            OutputDebugStringA(Line);
+          }
+          sprintf_s(Line, "  Memory: %lldKB committed of %dKB reserved\n",
+                    gMemoryCommitted / 1024, GameMemory.MemorySize / 1024);
+          OutputDebugStringA(Line);
+        }
+#endif
+
         if (gRedrawLevel) {
           gRedrawLevel = false;
         }
@@ -764,6 +1123,10 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
         //   // }
         // }
       }
+
+      if (RecordPath[0]) {
+        Win32SaveReplay(&Recording, RecordPath);
+      }
     }
   } else {
     // TODO: logging